@@ -174,6 +174,12 @@ CURLM* CurlWrapper::GetMultiHandle()
 	return global_curlm_handle;
 }
 
+std::recursive_mutex& CurlWrapper::GetMultiHandleMutex()
+{
+	static std::recursive_mutex mutex;
+	return mutex;
+}
+
 void CurlWrapper::InitCurl()
 {
 	DumpVersion();
@@ -183,9 +189,15 @@ void CurlWrapper::InitCurl()
 	if (cert_check_env != nullptr && std::string(cert_check_env) == "true") {
 		verify_certificate = false;
 	}
-	global_curlm_handle = curl_multi_init();
-	curl_multi_setopt(global_curlm_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
-	curl_multi_setopt(global_curlm_handle, CURLMOPT_MAX_HOST_CONNECTIONS, 5);
+	global_curlm_handle = CreateMultiHandle();
+}
+
+CURLM* CurlWrapper::CreateMultiHandle()
+{
+	CURLM* curlm = curl_multi_init();
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(curlm, CURLMOPT_MAX_HOST_CONNECTIONS, 5);
+	return curlm;
 }
 
 void CurlWrapper::KillCurl()
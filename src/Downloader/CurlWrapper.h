@@ -3,6 +3,7 @@
 #pragma once
 
 #include <curl/curl.h>
+#include <mutex>
 #include <string>
 
 class CurlWrapper
@@ -19,6 +20,16 @@ public:
 	static void InitCurl();
 	static void KillCurl();
 	static CURLM* GetMultiHandle();
+	/**
+	 * creates a new multi handle configured as the shared one, for transfers
+	 * that must not block the shared one
+	 */
+	static CURLM* CreateMultiHandle();
+	/**
+	 * The multi handle can be used by a single thread at a time, this must be
+	 * held while transfers are added to it and performed.
+	 */
+	static std::recursive_mutex& GetMultiHandleMutex();
 	void AddHeader(const std::string& header);
 
 private:
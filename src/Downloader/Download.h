@@ -7,8 +7,8 @@
 #include "FileSystem/IHash.h"
 #include "Rapid/Sdp.h"
 #include <cstdint>
+#include <functional>
 #include <list>
-#include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
@@ -70,9 +70,6 @@ public:
 	 */
 	uint64_t approx_size = 1;
 
-	std::map<CSdp*, uint64_t> rapid_size;
-	std::map<CSdp*, uint64_t> map_rapid_progress;
-
 	/**
 	 * state for whole file
 	 */
@@ -89,6 +86,12 @@ public:
 	bool noCache = false;
 	bool useETags = false;
 
+	/**
+	 * called by the http downloader as soon as this download finished and was verified, while
+	 * other downloads of the same batch continue. Called from the thread running the download.
+	 */
+	std::function<void(IDownload&)> onFinished;
+
 private:
 	uint64_t progress = 0;
 	std::vector<std::string> mirrors;
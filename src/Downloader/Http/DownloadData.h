@@ -9,20 +9,13 @@
 #include <string>
 #include <vector>
 
+#include "FileSystem/HashMD5.h"
 #include "IOThreadPool.h"
 
 class Mirror;
 class IDownload;
 class CurlWrapper;
-
-// Used for computing progress across multiple DownloadData downloaded in
-// parallel.
-class DownloadDataPack
-{
-public:
-	uint64_t size = 0;
-	uint64_t progress = 0;
-};
+class ProgressTracker;
 
 class DownloadData
 {
@@ -31,12 +24,13 @@ public:
 	std::unique_ptr<CurlWrapper> curlw;  // curl_easy_handle
 	std::string mirror;                  // mirror used
 	IDownload* download;
-	DownloadDataPack* data_pack = nullptr;
-	uint64_t approx_size = 0;  // Either approx or real size from the IDownload.
+	ProgressTracker* progress = nullptr;  // shared by all downloads done in parallel
+	uint64_t approx_size = 0;  // Either approx or real size from the IDownload, 0 if unknown.
 	int retry_num = 0;
 	std::chrono::seconds retry_after_from_server{0};
 	std::chrono::steady_clock::time_point next_retry;
 	bool force_discard = false;
+	std::unique_ptr<HashMD5> etag_hash;  // md5 of received data, recorded with ETag
 	std::optional<IOThreadPool::Handle> thread_handle;
 	bool io_failure = false;  // Used by IO threads
 	bool* abort_download = nullptr;
@@ -1,5 +1,6 @@
 #include "ETag.h"
 
+#include <cinttypes>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -8,14 +9,35 @@
 #include <string>
 
 #include "FileSystem/File.h"
+#include "FileSystem/FileIdentity.h"
 #include "FileSystem/FileSystem.h"
 #include "FileSystem/HashMD5.h"
 #include "Logger.h"
 
+// The .etag file contains a single line "md5 inode size mtime:etag". Files
+// written by older versions contain just "md5:etag".
+static void writeETagFile(const std::string& etagFile, const std::string& md5,
+                          const FileIdentity& identity, const std::string& value)
+{
+	CFile f;
+	if (!f.Open(etagFile)) {
+		return;
+	}
+	std::stringstream out;
+	out << md5 << " " << identity.inode << " " << identity.size << " " << identity.mtime << ":"
+		<< value;
+	if (!f.Write(out.str())) {
+		f.Close(/*discard=*/true);
+		return;
+	}
+	f.Close();
+}
+
 std::optional<std::string> getETag(const std::string& file)
 {
 	auto etagFile = file + ".etag";
-	if (!fileSystem->fileExists(file) || !fileSystem->fileExists(etagFile)) {
+	const auto identity = getFileIdentity(file);
+	if (!identity || !fileSystem->fileExists(etagFile)) {
 		return std::nullopt;
 	}
 
@@ -35,36 +57,41 @@ std::optional<std::string> getETag(const std::string& file)
 		LOG_ERROR("ETag file %s is in wrong format", etagFile.c_str());
 		return std::nullopt;
 	}
+	*colon = '\0';
+	const std::string value(colon + 1);
 
+	char md5[33];
+	FileIdentity recorded;
+	const int fields = sscanf(data, "%32s %" SCNu64 " %" SCNu64 " %" SCNd64, md5, &recorded.inode,
+	                          &recorded.size, &recorded.mtime);
+	if (fields == 4 && recorded == *identity) {
+		return value;
+	}
+	if (fields != 1 && fields != 4) {
+		LOG_ERROR("ETag file %s is in wrong format", etagFile.c_str());
+		return std::nullopt;
+	}
+
+	// File was touched or copied, or the record has no identity yet.
 	HashMD5 fileHash;
 	if (!fileSystem->hashFile(&fileHash, file)) {
 		return std::nullopt;
 	}
-	if (fileHash.toString() != std::string(data, colon)) {
+	if (fileHash.toString() != md5) {
 		return std::nullopt;
 	}
-	return std::string(colon + 1);
+	writeETagFile(etagFile, md5, *identity, value);
+	return value;
 }
 
-void setETag(const std::string& file, const std::string& value)
+void setETag(const std::string& file, const std::string& value, const std::string& md5)
 {
-	auto etagFile = file + ".etag";
 	if (value[0] != '"') {
 		return;
 	}
-	HashMD5 fileHash;
-	if (!fileSystem->hashFile(&fileHash, file)) {
+	const auto identity = getFileIdentity(file);
+	if (!identity) {
 		return;
 	}
-	CFile f;
-	if (!f.Open(etagFile)) {
-		return;
-	}
-	std::stringstream out;
-	out << fileHash.toString() << ":" << value;
-	if (!f.Write(out.str())) {
-		f.Close(/*discard=*/true);
-		return;
-	}
-	f.Close();
+	writeETagFile(file + ".etag", md5, *identity, value);
 }
@@ -3,5 +3,12 @@
 #include <optional>
 #include <string>
 
+/**
+ * returns ETag recorded for the file, if the file didn't change since. The file is hashed only
+ * when its size, mtime or inode differ from the recorded ones.
+ */
 std::optional<std::string> getETag(const std::string& file);
-void setETag(const std::string& file, const std::string& value);
+/**
+ * records ETag of the downloaded file together with md5 of its contents
+ */
+void setETag(const std::string& file, const std::string& value, const std::string& md5);
@@ -34,6 +34,7 @@
 
 #include "DownloadData.h"
 #include "Downloader/CurlWrapper.h"
+#include "Downloader/ProgressTracker.h"
 #include "ETag.h"
 #include "FileSystem/File.h"
 #include "FileSystem/FileSystem.h"
@@ -73,7 +74,9 @@ static int progress_func(DownloadData* data, curl_off_t total, curl_off_t done,
 // downloads url into res
 bool CHttpDownloader::DownloadUrl(const std::string& url, std::string& res)
 {
+	ProgressTracker progress;
 	DownloadData d(std::nullopt);
+	d.progress = &progress;
 	d.download = new IDownload();
 	d.download->addMirror(url);
 	d.download->name = url;
@@ -258,6 +261,9 @@ static size_t multi_write_data(void* ptr, size_t size, size_t nmemb, DownloadDat
 			if (data->download->out_hash != nullptr) {
 				data->download->out_hash->Update(buffer.get(), size);
 			}
+			if (data->etag_hash != nullptr) {
+				data->etag_hash->Update(buffer.get(), size);
+			}
 			if (!data->download->file->Write(buffer.get(), size)) {
 				return false;
 			}
@@ -266,20 +272,6 @@ static size_t multi_write_data(void* ptr, size_t size, size_t nmemb, DownloadDat
 	return size * nmemb;
 }
 
-// Computes the exponential retry duration to wait before making next request.
-template <class D1, class D2, class DR = typename std::common_type<D1, D2>::type>
-static DR retryAfter(int retry_num, D1 base_delay, D2 max_delay, double factor = 2.0)
-{
-	static std::default_random_engine gen(std::random_device{}());
-	static std::uniform_real_distribution<> dis(0.7, 1.2);
-	if (retry_num <= 0) {
-		return DR(0);
-	}
-	auto backoff = base_delay * std::pow(factor, retry_num - 1) * dis(gen);
-	return std::min(std::chrono::duration_cast<DR>(backoff),
-	                std::chrono::duration_cast<DR>(max_delay));
-}
-
 static bool setupDownload(CURLM* curlm, DownloadData* piece)
 {
 	static std::default_random_engine gen(std::random_device{}());
@@ -304,6 +296,10 @@ static bool setupDownload(CURLM* curlm, DownloadData* piece)
 		if (piece->download->out_hash != nullptr) {
 			piece->download->out_hash->Init();
 		}
+		if (piece->download->useETags) {
+			piece->etag_hash = std::make_unique<HashMD5>();
+			piece->etag_hash->Init();
+		}
 		return true;
 	}));
 
@@ -465,12 +461,13 @@ static bool handleSuccessTransfer(DownloadData* data, bool http_not_modified,
 	}
 	data->download->state = IDownload::STATE_FINISHED;
 	if (data->download->useETags && etag) {
-		// We call cleanupDownload here easly so that ETag  computation has a
-		// final not tmp file on disk to work with.
+		// We call cleanupDownload here early so that identity of the final,
+		// not tmp, file is recorded with the ETag.
 		if (!cleanupDownload(data)) {
 			return false;
 		}
-		setETag(data->download->name, etag.value());
+		data->etag_hash->Final();
+		setETag(data->download->name, etag.value(), data->etag_hash->toString());
 	}
 	return true;
 }
@@ -559,6 +556,15 @@ static bool processMessages(CURLM* curlm, std::vector<DownloadData*>* to_retry,
 				ok = ok && retry;
 		}
 		data->thread_handle->submit(ioFailureWrap(data, cleanupDownload));
+		if (msg->data.result == CURLE_OK && data->download->onFinished) {
+			// Queued after the cleanup, so the file is already in place.
+			data->thread_handle->submit([data]() -> IOThreadPool::OptRetF {
+				if (data->io_failure || !data->download->isFinished()) {
+					return std::nullopt;
+				}
+				return [dl = data->download] { dl->onFinished(*dl); };
+			});
+		}
 		if (data->curlw != nullptr) {
 			curl_multi_remove_handle(curlm, data->curlw->GetHandle());
 			data->curlw = nullptr;
@@ -607,6 +613,17 @@ static unsigned getMaxReqsPerSecLimit()
 }
 
 bool CHttpDownloader::download(std::list<IDownload*>& download, int max_parallel)
+{
+	return downloadFiles(download, max_parallel, /*background=*/false);
+}
+
+bool CHttpDownloader::DownloadInBackground(std::list<IDownload*>& download, int max_parallel)
+{
+	return downloadFiles(download, max_parallel, /*background=*/true);
+}
+
+bool CHttpDownloader::downloadFiles(std::list<IDownload*>& download, int max_parallel,
+                                    bool background)
 {
 	TRACE();
 
@@ -617,7 +634,7 @@ bool CHttpDownloader::download(std::list<IDownload*>& download, int max_parallel
 
 	// Prepare downloads from input.
 	std::vector<std::unique_ptr<DownloadData>> downloads;
-	DownloadDataPack download_pack;
+	ProgressTracker progress;
 	bool abort_download = false;
 	for (IDownload* dl : download) {
 		if (dl->isFinished()) {
@@ -635,14 +652,11 @@ bool CHttpDownloader::download(std::list<IDownload*>& download, int max_parallel
 		auto dlData = downloads.back().get();
 		dlData->abort_download = &abort_download;
 		dlData->download = dl;
-		dlData->data_pack = &download_pack;
-		if (dl->size > 0) {
-			dlData->approx_size = dl->size;
-			download_pack.size += dl->size;
-		} else {
-			dlData->approx_size = dl->approx_size;
-			download_pack.size += dl->approx_size;
-		}
+		// Progress of background downloads isn't reported, the listener
+		// and progress bar belong to downloads in foreground.
+		dlData->progress = background ? nullptr : &progress;
+		dlData->approx_size = dl->size > 0 ? dl->size : dl->approx_size;
+		progress.addTotal(dlData->approx_size);
 	}
 	if (downloads.empty()) {
 		LOG_DEBUG("Nothing to download!");
@@ -657,7 +671,16 @@ bool CHttpDownloader::download(std::list<IDownload*>& download, int max_parallel
 
 	// Perform actual download using the Curl multi interface.
 	HTTPStats stats;
-	CURLM* curlm = CurlWrapper::GetMultiHandle();
+	std::unique_lock<std::recursive_mutex> curlm_lock;
+	std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> own_curlm(nullptr, curl_multi_cleanup);
+	CURLM* curlm;
+	if (background) {
+		own_curlm.reset(CurlWrapper::CreateMultiHandle());
+		curlm = own_curlm.get();
+	} else {
+		curlm_lock = std::unique_lock<std::recursive_mutex>(CurlWrapper::GetMultiHandleMutex());
+		curlm = CurlWrapper::GetMultiHandle();
+	}
 
 	std::vector<DownloadData*> to_retry;
 	auto queue_comparator = [](DownloadData* a, DownloadData* b) {
@@ -732,6 +755,11 @@ bool CHttpDownloader::download(std::list<IDownload*>& download, int max_parallel
 	         computeStats(stats.total_transfer_time).c_str(), stats.num_errors);
 abort:
 	thread_pool.finish();
+	if (!background) {
+		// Last update might have been throttled, and skipped or failed files
+		// don't add to done, so finishing isn't always reported by itself.
+		progress.report(/*force=*/true);
+	}
 	// Cleanup
 	for (auto& data : downloads) {
 		cleanupDownload(data.get());
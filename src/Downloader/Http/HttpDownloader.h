@@ -14,7 +14,15 @@ public:
 	virtual bool search(std::list<IDownload*>& result,
 	                    const std::vector<DownloadSearchItem*>& items) override;
 	virtual bool download(std::list<IDownload*>& download, int max_parallel = 10) override;
+	/**
+	 * downloads without reporting progress, using own curl multi handle so
+	 * that downloads started meanwhile on other threads don't wait for it
+	 */
+	static bool DownloadInBackground(std::list<IDownload*>& download, int max_parallel = 10);
 	static bool DownloadUrl(const std::string& url, std::string& res);
 	static bool ParseResult(const std::string& name, const std::string& json,
 	                        std::list<IDownload*>& res);
+
+private:
+	static bool downloadFiles(std::list<IDownload*>& download, int max_parallel, bool background);
 };
@@ -22,10 +22,11 @@ void IDownloader::Initialize()
 
 void IDownloader::Shutdown()
 {
-	delete (httpdl);
-	httpdl = nullptr;
+	// Rapid might be still using http in the background.
 	delete (rapiddl);
 	rapiddl = nullptr;
+	delete (httpdl);
+	httpdl = nullptr;
 	CurlWrapper::KillCurl();
 }
 static bool abortDownloads = false;
@@ -0,0 +1,22 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "ProgressTracker.h"
+
+#include "IDownloader.h"
+#include "Logger.h"
+
+void ProgressTracker::report(bool force)
+{
+	// Nothing is known before the first transfer reports its size.
+	const bool finished = total > 0 && done >= total;
+	const auto now = std::chrono::steady_clock::now();
+	if (!force && (finished ? reportedFinished : now - lastReport < REPORT_INTERVAL)) {
+		return;
+	}
+	lastReport = now;
+	reportedFinished = finished;
+	if (IDownloader::listener != nullptr) {
+		IDownloader::listener(done, total);
+	}
+	LOG_PROGRESS(done, total, finished || force);
+}
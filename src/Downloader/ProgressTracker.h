@@ -0,0 +1,61 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Progress of transfers running in parallel.
+ *
+ * Transfers add differences to their previous values, so updating the totals
+ * doesn't depend on the number of transfers. Reporting to the download
+ * listener and the progress bar is limited to 10 times per second, except
+ * when the transfer finishes. Transfers can end without reaching the total,
+ * so the final state is reported with force when they are done.
+ *
+ * Not thread safe, it's updated from the curl multi loop.
+ */
+class ProgressTracker
+{
+public:
+	void addTotal(int64_t delta)
+	{
+		total += delta;
+	}
+
+	void addDone(int64_t delta)
+	{
+		done += delta;
+	}
+
+	void set(int64_t done_, int64_t total_)
+	{
+		done = done_;
+		total = total_;
+	}
+
+	int64_t getDone() const
+	{
+		return done;
+	}
+
+	int64_t getTotal() const
+	{
+		return total;
+	}
+
+	/**
+	 * reports progress unless it was reported less than 100ms ago, finished
+	 * progress and force are always reported
+	 */
+	void report(bool force = false);
+
+private:
+	static constexpr std::chrono::milliseconds REPORT_INTERVAL{100};
+
+	int64_t done = 0;
+	int64_t total = 0;
+	std::chrono::steady_clock::time_point lastReport;
+	bool reportedFinished = false;
+};
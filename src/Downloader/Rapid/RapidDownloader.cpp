@@ -2,28 +2,29 @@
 
 #include "RapidDownloader.h"
 #include "Downloader/Download.h"
+#include "Downloader/Http/HttpDownloader.h"
 #include "FileSystem/FileSystem.h"
 #include "Logger.h"
 #include "Repo.h"
+#include "RepoRoutes.h"
 #include "Sdp.h"
 #include "Tracer.h"
 #include "Util.h"
 
 #include <algorithm>  //std::min
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <list>
+#include <optional>
 #include <set>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <zlib.h>
-
-#ifndef _WIN32
-#include <regex.h>
-#endif
 #undef min
 #undef max
 
@@ -35,27 +36,111 @@ CRapidDownloader::CRapidDownloader()
 	} else {
 		reposgzurl = master_repo_env;
 	}
+	const char* background_refresh_env = std::getenv("PRD_RAPID_BACKGROUND_REFRESH");
+	background_refresh =
+		background_refresh_env != nullptr && std::string(background_refresh_env) == "true";
+}
+
+CRapidDownloader::~CRapidDownloader()
+{
+	if (refresher.joinable()) {
+		refresher.join();
+	}
+	IDownloader::freeResult(pending_refresh);
 }
 
-void CRapidDownloader::addRemoteSdp(CSdp&& sdp)
+void CRapidDownloader::refreshInBackground(std::list<IDownload*>& dls)
 {
-	sdps.push_back(std::move(sdp));
+	if (dls.empty()) {
+		return;
+	}
+	if (refreshing) {
+		// Files will be refreshed by a later search.
+		LOG_DEBUG("Background refresh of repos still running");
+		IDownloader::freeResult(dls);
+		return;
+	}
+	if (refresher.joinable()) {
+		refresher.join();
+	}
+	refreshing = true;
+	refresher = std::thread([this, dls = std::move(dls)]() mutable {
+		LOG_DEBUG("Refreshing %zu repo files in background", dls.size());
+		if (!CHttpDownloader::DownloadInBackground(dls)) {
+			LOG_WARN("Background refresh of repos failed");
+		}
+		IDownloader::freeResult(dls);
+		refreshing = false;
+	});
+	dls.clear();
 }
 
-bool CRapidDownloader::list_compare(const CSdp& first, const CSdp& second)
+void CRapidDownloader::rebuildIndexes()
 {
-	const std::string& name1 = first.getShortName();
-	const std::string& name2 = second.getShortName();
-	const unsigned len = std::min(name1.size(), name2.size());
-	for (unsigned i = 0; i < len; i++) {
-		int c1 = tolower(name1[i]);
-		int c2 = tolower(name2[i]);
-		if (c1 == c2) {
+	TRACE();
+	sdps.clear();
+	sdpsByShortName.clear();
+	sdpsByName.clear();
+	sdpsByMD5.clear();
+	std::unordered_set<std::string_view> listed;
+	for (const CRepo& repo : repos) {
+		auto it = repoPackages.find(repo.getUrl());
+		if (it == repoPackages.end()) {
 			continue;
 		}
-		return c1 < c2;
+		listed.insert(it->first);
+		for (CSdp& sdp : it->second.sdps) {
+			// The same package can be listed by multiple repos, first one wins.
+			auto& sameMD5 = sdpsByMD5[sdp.getMD5()];
+			const bool known = std::any_of(sameMD5.begin(), sameMD5.end(), [&](const CSdp* other) {
+				return other->getShortName() == sdp.getShortName() &&
+				       other->getName() == sdp.getName();
+			});
+			if (known) {
+				continue;
+			}
+			sdps.push_back(&sdp);
+			sameMD5.push_back(&sdp);
+			sdpsByShortName[sdp.getShortName()].push_back(&sdp);
+			sdpsByName[sdp.getName()].push_back(&sdp);
+		}
+	}
+	// Forget repos that were removed from repos.gz.
+	for (auto it = repoPackages.begin(); it != repoPackages.end();) {
+		if (listed.count(it->first) == 0) {
+			it = repoPackages.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+bool CRapidDownloader::is_wildcard(const std::string& name)
+{
+	return name == "" || name == "*";
+}
+
+std::vector<CSdp*> CRapidDownloader::find_sdps(const std::string& name, bool byShortName)
+{
+	std::vector<CSdp*> res;
+	if (is_wildcard(name)) {
+		return sdps;
+	}
+	if (auto it = sdpsByName.find(name); it != sdpsByName.end()) {
+		res = it->second;
+	}
+	if (!byShortName) {
+		return res;
+	}
+	if (auto it = sdpsByShortName.find(name); it != sdpsByShortName.end()) {
+		for (CSdp* sdp : it->second) {
+			// Package might have the same short and full name.
+			if (sdp->getName() != name) {
+				res.push_back(sdp);
+			}
+		}
 	}
-	return false;
+	return res;
 }
 
 bool CRapidDownloader::download_name(std::list<IDownload*>& downloads)
@@ -65,18 +150,16 @@ bool CRapidDownloader::download_name(std::list<IDownload*>& downloads)
 	std::vector<std::pair<CSdp*, IDownload*>> packages;
 	for (auto download : downloads) {
 		LOG_DEBUG("Using rapid to download %s", download->name.c_str());
-		for (CSdp& sdp : sdps) {
-			if (!match_download_name(sdp.getName(), download->name)) {
-				continue;
-			}
-			if (auto it = found_packages.find(sdp.getMD5()); it != found_packages.end()) {
+		for (CSdp* sdp : find_sdps(download->name, false)) {
+			if (auto it = found_packages.find(std::string(sdp->getMD5()));
+			    it != found_packages.end()) {
 				if (it->second != download) {
 					deduped[download] = it->second;
 				}
 			} else {
-				found_packages[sdp.getMD5()] = download;
-				LOG_INFO("[Download] %s", sdp.getName().c_str());
-				packages.emplace_back(&sdp, download);
+				found_packages[std::string(sdp->getMD5())] = download;
+				LOG_INFO("[Download] %s", sdp->getName().data());
+				packages.emplace_back(sdp, download);
 			}
 		}
 	}
@@ -119,30 +202,25 @@ bool CRapidDownloader::search(std::list<IDownload*>& result,
 		return false;
 	}
 
-	sdps.sort(list_compare);
-
 	for (auto& item : items) {
 		if (item->found) {
 			continue;
 		}
 		// To make sure that both rapid://zk:stable and zk:stable works.
 		auto name = stripRapidUri(item->name);
-		for (const CSdp& sdp : sdps) {
-			if (match_download_name(sdp.getShortName(), name) ||
-			    match_download_name(sdp.getName(), name)) {
-				item->found = true;
-				// We ensure "rapid://" uri for origin name to have better
-				// deduplication when resolving depends that are using uri scheme for
-				// rapid tags.
-				IDownload* dl = new IDownload(sdp.getName().c_str(), ensureRapidUri(item->name),
-				                              item->category, IDownload::TYP_RAPID);
-				dl->addMirror(sdp.getShortName().c_str());
-				for (auto const& dep : sdp.getDepends()) {
-					assert(!dep.empty());
-					dl->addDepend(dep);
-				}
-				result.push_back(dl);
+		for (const CSdp* sdp : find_sdps(name, true)) {
+			item->found = true;
+			// We ensure "rapid://" uri for origin name to have better
+			// deduplication when resolving depends that are using uri scheme for
+			// rapid tags.
+			IDownload* dl = new IDownload(std::string(sdp->getName()), ensureRapidUri(item->name),
+			                              item->category, IDownload::TYP_RAPID);
+			dl->addMirror(std::string(sdp->getShortName()));
+			for (std::string_view dep : sdp->getDepends()) {
+				assert(!dep.empty());
+				dl->addDepend(std::string(dep));
 			}
+			result.push_back(dl);
 		}
 	}
 	return true;
@@ -160,24 +238,6 @@ bool CRapidDownloader::download(std::list<IDownload*>& downloads, int /*max_para
 	return rapid_downloads.empty() || download_name(rapid_downloads);
 }
 
-bool CRapidDownloader::match_download_name(const std::string& str1, const std::string& str2)
-{
-	return str2 == "" || str2 == "*" || str1 == str2;
-	// FIXME: add regex support for win32
-	/*
-  #ifndef _WIN32
-	      regex_t regex;
-	      if (regcomp(&regex, str2.c_str(), 0)==0) {
-	              int res=regexec(&regex, str1.c_str(),0, nullptr, 0 );
-	              regfree(&regex);
-	              if (res==0) {
-	                      return true;
-	              }
-	      }
-  #endif
-  */
-}
-
 bool CRapidDownloader::setOption(const std::string& key, const std::string& value)
 {
 	LOG_INFO("setOption %s = %s", key.c_str(), value.c_str());
@@ -200,50 +260,39 @@ bool CRapidDownloader::UpdateReposGZ()
 	fileSystem->createSubdirs(CFileSystem::DirName(path));
 	LOG_DEBUG("%s", reposgzurl.c_str());
 	// first try already downloaded file, as repo master file rarely changes
-	if ((fileSystem->fileExists(path)) && (!fileSystem->isOlder(path, REPO_MASTER_RECHECK_TIME)) &&
-	    parse())
+	const bool exists = fileSystem->fileExists(path);
+	const bool stale = !exists || fileSystem->isOlder(path, REPO_MASTER_RECHECK_TIME);
+	if (exists && (!stale || background_refresh) && parse()) {
+		if (stale) {
+			IDownload* dl = new IDownload(path);
+			dl->noCache = true;
+			dl->addMirror(reposgzurl);
+			pending_refresh.push_back(dl);
+		}
 		return true;
+	}
 	IDownload dl(path);
 	dl.noCache = true;
 	dl.addMirror(reposgzurl);
 	return httpDownload->download(&dl) && parse();
 }
 
-static bool ParseFD(FILE* f, const std::string& path, std::list<CRepo>& repos,
-                    CRapidDownloader* rapid)
+static bool ParseFD(FILE* f, const std::string& path, std::list<CRepo>& repos)
 {
 	repos.clear();
-	int fd = fileSystem->dupFileFD(f);
-	if (fd < 0) {
-		return false;
-	}
-	gzFile fp = gzdopen(fd, "rb");
-	if (fp == Z_NULL) {
-		LOG_ERROR("Could not open %s", path.c_str());
-		return false;
-	}
-	char buf[IO_BUF_SIZE];
 	int i = 0;
-	while (gzgets(fp, buf, sizeof(buf)) != Z_NULL) {
-		const std::string line = buf;
-		const std::vector<std::string> items = tokenizeString(line, ',');
+	std::vector<std::string_view> items;
+	const bool ok = forEachGzLine(f, path, [&](std::string_view line) {
+		tokenizeString(line, ',', items);
 		if (items.size() <= 2) {  // create new repo from url
-			LOG_ERROR("Parse Error %s, Line %d: %s", path.c_str(), i, buf);
-			gzclose(fp);
+			LOG_ERROR("Parse Error %s, Line %d: %.*s", path.c_str(), i, (int)line.size(),
+			          line.data());
 			return false;
 		}
 		i++;
-		CRepo repotmp = CRepo(items[1], items[0], rapid);
-		repos.push_back(repotmp);
-	}
-	int errnum = Z_OK;
-	bool ok = true;
-	const char* errstr = gzerror(fp, &errnum);
-	if (errnum != Z_OK && errnum != Z_STREAM_END) {
-		LOG_ERROR("Decompression error: %d %s\n", errnum, errstr);
-		ok = false;
-	}
-	gzclose(fp);
+		repos.emplace_back(std::string(items[1]), std::string(items[0]));
+		return true;
+	});
 	if (!ok) {
 		return false;
 	}
@@ -262,7 +311,7 @@ bool CRapidDownloader::parse()
 		return false;
 	}
 
-	const bool res = ParseFD(f, path, repos, this);
+	const bool res = ParseFD(f, path, repos);
 	fclose(f);
 	if (!res) {
 		CFileSystem::removeFile(path);
@@ -275,47 +324,156 @@ bool CRapidDownloader::updateRepos(const std::vector<std::string>& searchstrs)
 {
 	TRACE();
 	LOG_DEBUG("%s", "Updating repos...");
+	IDownloader::freeResult(pending_refresh);
 	if (!UpdateReposGZ()) {
 		return false;
 	}
+	if (!routes) {
+		routes = std::make_unique<RepoRoutes>(CFileSystem::DirName(path) + PATH_DELIMITER +
+		                                      "repo-routes.txt");
+		routes->Load();
+	}
 
-	std::list<IDownload*> dls;
-	std::unordered_set<CRepo*> usedrepos;
-
-	for (auto const& searchstr : searchstrs) {
+	std::vector<CRepo*> selected;  // in order of repos.gz, so that results are deterministic
+	std::unordered_set<CRepo*> seenrepos;
+	std::vector<std::string> routed;
+	const auto select = [&](const std::string& searchstr, bool useRoutes) {
 		std::string tag = "";
 		const std::string::size_type pos = searchstr.find(':');
 		if (pos != std::string::npos) {  // a tag is found, set it
 			tag = searchstr.substr(0, pos);
 		}
+		// Untagged names would need all repos, so we first try only the
+		// repos which had packages with similar names before.
+		std::set<std::string> likely;
+		if (tag == "" && useRoutes && !is_wildcard(searchstr)) {
+			likely = routes->Lookup(searchstr);
+			if (!likely.empty()) {
+				routed.push_back(searchstr);
+			}
+		}
 		for (CRepo& repo : repos) {
 			if (tag != "" && repo.getShortName() != tag) {
 				continue;
 			}
-			if (usedrepos.find(&repo) == usedrepos.end()) {
-				IDownload* dl = repo.getDownload();
-				if (dl == nullptr) {
-					continue;
-				}
-				usedrepos.insert(&repo);
-				dls.push_back(dl);
+			if (!likely.empty() && likely.count(repo.getShortName()) == 0) {
+				continue;
 			}
+			if (seenrepos.insert(&repo).second) {
+				selected.push_back(&repo);
+			}
+		}
+	};
+
+	for (auto const& searchstr : searchstrs) {
+		select(searchstr, true);
+	}
+	bool ok = fetchRepos(selected);
+
+	// Routes might be outdated, names that weren't found are searched in all repos.
+	selected.clear();
+	for (auto const& searchstr : routed) {
+		if (find_sdps(searchstr, true).empty()) {
+			LOG_DEBUG("%s not found in routed repos, checking all repos", searchstr.c_str());
+			select(searchstr, false);
+		}
+	}
+	if (ok && !selected.empty()) {
+		ok = fetchRepos(selected);
+	}
+	routes->Save();
+	refreshInBackground(pending_refresh);
+	return ok;
+}
+
+bool CRapidDownloader::fetchRepos(const std::vector<CRepo*>& selected)
+{
+	std::list<IDownload*> dls;
+	std::vector<CRepo*> usedrepos;
+	for (CRepo* repo : selected) {
+		IDownload* dl = repo->getDownload();
+		if (dl == nullptr) {
+			continue;
+		}
+		usedrepos.push_back(repo);
+		if (background_refresh && fileSystem->fileExists(repo->getRepoFile())) {
+			pending_refresh.push_back(dl);
+		} else {
+			dls.push_back(dl);
 		}
 	}
 
 	LOG_DEBUG("Downloading version.gz updates...");
 	if (!httpDownload->download(dls)) {
 		IDownloader::freeResult(dls);
+		IDownloader::freeResult(pending_refresh);
 		return false;
 	}
+	IDownloader::freeResult(dls);
+	return parseRepos(usedrepos);
+}
+
+bool CRapidDownloader::parseRepos(const std::vector<CRepo*>& toparse)
+{
+	TRACE();
+	// Decompressing is CPU bound and repos are independent, so they are
+	// parsed in parallel and merged afterwards in the given order.
+	std::vector<std::optional<FileIdentity>> identities(toparse.size());
+	std::vector<std::vector<CSdp>> parsed(toparse.size());
+	std::vector<char> failed(toparse.size(), false);
+	std::vector<char> unchanged(toparse.size(), false);
+	std::atomic<size_t> next = 0;
+	const auto worker = [&]() {
+		for (size_t i = next++; i < toparse.size(); i = next++) {
+			// Identity is taken before parsing, so that concurrent changes
+			// cause parsing again next time.
+			identities[i] = getFileIdentity(toparse[i]->getRepoFile());
+			auto it = repoPackages.find(toparse[i]->getUrl());
+			if (identities[i] && it != repoPackages.end() && it->second.identity == identities[i]) {
+				unchanged[i] = true;
+				continue;
+			}
+			failed[i] = !toparse[i]->parse(parsed[i]);
+		}
+	};
+	const unsigned numThreads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+	                                               std::max<size_t>(toparse.size(), 1));
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < numThreads; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : threads) {
+		t.join();
+	}
+
 	bool ok = true;
-	for (CRepo* repo : usedrepos) {
-		if (!repo->parse()) {
-			repo->deleteRepoFile();
+	size_t reparsed = 0;
+	for (size_t i = 0; i < toparse.size(); ++i) {
+		if (unchanged[i]) {
+			continue;
+		}
+		if (failed[i]) {
+			toparse[i]->deleteRepoFile();
 			ok = false;
-			break;
+			continue;
+		}
+		RepoPackages& packages = repoPackages[toparse[i]->getUrl()];
+		packages.identity = identities[i];
+		packages.sdps = std::move(parsed[i]);
+		++reparsed;
+		if (routes) {
+			std::unordered_set<std::string_view> prefixes;
+			for (const CSdp& sdp : packages.sdps) {
+				if (prefixes.insert(RepoRoutes::NamePrefix(sdp.getName())).second) {
+					routes->Add(sdp.getName(), toparse[i]->getShortName());
+				}
+			}
 		}
 	}
-	IDownloader::freeResult(dls);
+	LOG_DEBUG("Parsed %zu of %zu repos, others didn't change", reparsed, toparse.size());
+	if (reparsed > 0) {
+		rebuildIndexes();
+	}
 	return ok;
 }
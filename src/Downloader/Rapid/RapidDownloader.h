@@ -3,10 +3,18 @@
 #pragma once
 
 #include "Downloader/IDownloader.h"
+#include "FileSystem/FileIdentity.h"
 
+#include <atomic>
 #include <list>
+#include <memory>
+#include <optional>
 #include <stdio.h>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #define REPO_MASTER_RECHECK_TIME \
 	86400  // how long to cache the repo-master file in secs without rechecking
@@ -17,11 +25,13 @@ class CSdp;
 class CHttpDownload;
 class CFileSystem;
 class CRepo;
+class RepoRoutes;
 
 class CRapidDownloader : public IDownloader
 {
 public:
 	CRapidDownloader();
+	~CRapidDownloader() override;
 
 	/**
 	 * search for a mod, searches for the short + long name
@@ -35,15 +45,41 @@ public:
 
 	bool setOption(const std::string& key, const std::string& value) override;
 
-	void addRemoteSdp(CSdp&& dsp);
-
 private:
 	bool updateRepos(const std::vector<std::string>& searchstrs);
+	/**
+	 * downloads and parses versions.gz of the repos
+	 */
+	bool fetchRepos(const std::vector<CRepo*>& selected);
+	/**
+	 * parses versions.gz of the repos that changed since they were parsed
+	 * last time and replaces their packages
+	 */
+	bool parseRepos(const std::vector<CRepo*>& toparse);
+	/**
+	 * rebuilds the indexes from packages of all repos
+	 */
+	void rebuildIndexes();
 	bool parse();
 	bool UpdateReposGZ();
+	/**
+	 * downloads dls on a background thread, unless a refresh is still running.
+	 * Refreshed files can be parsed by a search meanwhile: they are replaced
+	 * by an atomic rename, so a parser sees either the old or the new file.
+	 */
+	void refreshInBackground(std::list<IDownload*>& dls);
+
+	// With background refresh, searches use cached repo files right away and
+	// they are refreshed in background for the next search.
+	bool background_refresh = false;
+	std::list<IDownload*> pending_refresh;
+	std::thread refresher;
+	std::atomic<bool> refreshing = false;
+
 	std::string path;
 	std::string reposgzurl;
 	std::list<CRepo> repos;
+	std::unique_ptr<RepoRoutes> routes;  // loaded on first search
 
 	/**
 	 * download by name, for example "Complete Annihilation revision 1234"
@@ -51,12 +87,30 @@ private:
 	bool download_name(std::list<IDownload*>& downloads);
 
 	/**
-	 * compare str1 with str2
-	 * if str2==* or "" it matches
+	 * returns true if name matches all packages ("*" or "")
 	 * used for search in downloaders
 	 */
-	static bool match_download_name(const std::string& str1, const std::string& str2);
+	static bool is_wildcard(const std::string& name);
+
+	/**
+	 * returns packages with the given full name, or also the given short name
+	 * when byShortName is set, in the order they were added
+	 */
+	std::vector<CSdp*> find_sdps(const std::string& name, bool byShortName);
+
+	// Packages of a repo as parsed from its versions.gz, kept between searches.
+	struct RepoPackages {
+		std::optional<FileIdentity> identity;  // of versions.gz when it was parsed
+		std::vector<CSdp> sdps;
+	};
+	std::unordered_map<std::string, RepoPackages> repoPackages;  // by repo url
+
+	// Keys point to strings owned by the packages.
+	using SdpIndex = std::unordered_map<std::string_view, std::vector<CSdp*>>;
 
-	static bool list_compare(const CSdp& first, const CSdp& second);
-	std::list<CSdp> sdps;
+	// Packages of all repos in repos.gz order, without duplicates.
+	std::vector<CSdp*> sdps;
+	SdpIndex sdpsByShortName;
+	SdpIndex sdpsByName;
+	SdpIndex sdpsByMD5;
 };
@@ -6,16 +6,16 @@
 #include "Logger.h"
 #include "RapidDownloader.h"
 #include "Sdp.h"
+#include "StringArena.h"
 #include "Tracer.h"
 #include "Util.h"
 
 #include <cassert>
 #include <stdio.h>
-#include <zlib.h>
+#include <string_view>
 
-CRepo::CRepo(const std::string& repourl, const std::string& _shortname, CRapidDownloader* rapid)
+CRepo::CRepo(const std::string& repourl, const std::string& _shortname)
 	: repourl(repourl)
-	, rapid(rapid)
 	, shortname(_shortname)
 {
 }
@@ -39,7 +39,7 @@ IDownload* CRepo::getDownload()
 	return dl;
 }
 
-bool CRepo::parse()
+bool CRepo::parse(std::vector<CSdp>& sdps)
 {
 	TRACE();
 	assert(!tmpFile.empty());
@@ -53,53 +53,25 @@ bool CRepo::parse()
 		LOG_ERROR("Could not open %s", tmpFile.c_str());
 		return false;
 	}
-	int fd = fileSystem->dupFileFD(f);
-	if (fd < 0) {
-		fclose(f);
-		return false;
-	}
-	gzFile fp = gzdopen(fd, "rb");
-	if (fp == Z_NULL) {
-		fclose(f);
-		LOG_ERROR("Could not gzdopen %s", tmpFile.c_str());
-		return false;
-	}
-
-	char buf[IO_BUF_SIZE];
+	arena = std::make_shared<StringArena>();
 	sdps.clear();
-	while ((gzgets(fp, buf, sizeof(buf))) != Z_NULL) {
-		for (unsigned int i = 0; i < sizeof(buf); i++) {
-			if (buf[i] == '\n') {
-				buf[i] = 0;
-				break;
-			}
-		}
-
-		const std::string line = buf;
-		std::vector<std::string> items = tokenizeString(line, ',');
+	std::vector<std::string_view> items;
+	std::vector<std::string_view> deps;
+	const bool ok = forEachGzLine(f, tmpFile, [&](std::string_view line) {
+		tokenizeString(line, ',', items);
 		if (items.size() < 4) {
-			LOG_ERROR("Invalid line: %s", line.c_str());
-			gzclose(fp);
-			fclose(f);
+			LOG_ERROR("Invalid line: %.*s", (int)line.size(), line.data());
 			return false;
 		}
 
 		// create new repo from url
-		std::vector<std::string> deps;
+		deps.clear();
 		if (!items[2].empty()) {
-			deps = tokenizeString(items[2], '|');
+			tokenizeString(items[2], '|', deps);
 		}
-		rapid->addRemoteSdp(CSdp(std::move(items[0]), std::move(items[1]), std::move(items[3]),
-		                         std::move(deps), repourl));
-	}
-	int errnum = Z_OK;
-	bool ok = true;
-	const char* errstr = gzerror(fp, &errnum);
-	if (errnum != Z_OK && errnum != Z_STREAM_END) {
-		LOG_ERROR("%d %s\n", errnum, errstr);
-		ok = false;
-	}
-	gzclose(fp);
+		sdps.emplace_back(arena, items[0], items[1], items[3], deps, repourl);
+		return true;
+	});
 	fclose(f);
 	return ok;
 }
@@ -2,17 +2,18 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
 class CSdp;
-class CRapidDownloader;
+class StringArena;
 class IDownload;
 
 class CRepo
 {
 public:
-	CRepo(const std::string& repourl, const std::string& shortname, CRapidDownloader* rapid);
+	CRepo(const std::string& repourl, const std::string& shortname);
 
 	/**
 	 * returns download for a repo file
@@ -20,12 +21,13 @@ public:
 	IDownload* getDownload();
 
 	/**
-	 * parse a repo file (versions.gz)
+	 * parse a repo file (versions.gz) into sdps
 	 * a line looks like
 	 * nota:revision:1,52a86b5de454a39db2546017c2e6948d,,NOTA test-1
 	 * <tag>,<md5>,<depends on (descriptive name)>,<descriptive name>
+	 * Different repos can be parsed in parallel.
 	 */
-	bool parse();
+	bool parse(std::vector<CSdp>& sdps);
 
 	bool deleteRepoFile();
 
@@ -34,10 +36,22 @@ public:
 		return shortname;
 	}
 
+	const std::string& getUrl() const
+	{
+		return repourl;
+	}
+
+	/**
+	 * returns path of the local versions.gz, set by getDownload
+	 */
+	const std::string& getRepoFile() const
+	{
+		return tmpFile;
+	}
+
 private:
 	std::string repourl;
-	CRapidDownloader* rapid;
-	std::vector<CSdp*> sdps;
+	std::shared_ptr<StringArena> arena;  // strings of packages from the last parse
 	std::string tmpFile;
 	std::string shortname;
 };
@@ -0,0 +1,98 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "RepoRoutes.h"
+
+#include "FileSystem/FileSystem.h"
+#include "Logger.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+RepoRoutes::RepoRoutes(std::string path_)
+	: path(std::move(path_))
+{
+}
+
+std::string_view RepoRoutes::NamePrefix(std::string_view name)
+{
+	const size_t pos = name.rfind(' ');
+	if (pos == std::string_view::npos || pos == 0) {
+		return name;
+	}
+	return name.substr(0, pos);
+}
+
+void RepoRoutes::Load()
+{
+	routes.clear();
+	modified = false;
+	std::ifstream in(u8ToPath(path));
+	std::string line;
+	// Line format: <prefix>\t<repo>
+	while (std::getline(in, line)) {
+		const size_t pos = line.rfind('\t');
+		if (pos == std::string::npos) {
+			LOG_WARN("Ignoring invalid repo routes %s", path.c_str());
+			routes.clear();
+			return;
+		}
+		routes[line.substr(0, pos)].insert(line.substr(pos + 1));
+	}
+}
+
+bool RepoRoutes::Save()
+{
+	if (!modified) {
+		return true;
+	}
+	const std::string tmpPath = path + ".tmp";
+	FILE* f = CFileSystem::propen(tmpPath, "wb");
+	if (f == nullptr) {
+		return false;
+	}
+	bool ok = true;
+	for (const auto& [prefix, repos] : routes) {
+		for (const std::string& repo : repos) {
+			ok = ok && fprintf(f, "%s\t%s\n", prefix.c_str(), repo.c_str()) > 0;
+		}
+	}
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		LOG_WARN("Failed to write repo routes %s: %s", tmpPath.c_str(), strerror(errno));
+		CFileSystem::removeFile(tmpPath);
+		return false;
+	}
+	modified = false;
+	return fileSystem->Rename(tmpPath, path);
+}
+
+void RepoRoutes::Add(std::string_view name, const std::string& repo)
+{
+	const std::string_view prefix = NamePrefix(name);
+	// Names with tabs or new lines can't be stored, and can't be searched for.
+	if (prefix.find_first_of("\t\n") != std::string_view::npos) {
+		return;
+	}
+	auto it = routes.find(std::string(prefix));
+	if (it == routes.end()) {
+		it = routes.emplace(prefix, std::set<std::string>()).first;
+	}
+	if (it->second.insert(repo).second) {
+		modified = true;
+	}
+}
+
+std::set<std::string> RepoRoutes::Lookup(std::string_view name) const
+{
+	std::set<std::string> res;
+	for (std::string_view key : {name, NamePrefix(name)}) {
+		if (auto it = routes.find(std::string(key)); it != routes.end()) {
+			res.insert(it->second.begin(), it->second.end());
+		}
+	}
+	return res;
+}
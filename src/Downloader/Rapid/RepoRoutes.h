@@ -0,0 +1,50 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Persistent mapping from package name prefixes to repos that had packages
+ * with that prefix, learned from parsed versions.gz files.
+ *
+ * The prefix is the name without its last word, which is usually a version,
+ * so "Beyond All Reason test-12345-abc" routes by "Beyond All Reason". It
+ * allows to refresh only repos likely to contain an untagged name.
+ */
+class RepoRoutes
+{
+public:
+	explicit RepoRoutes(std::string path);
+
+	/**
+	 * loads routes saved before, missing or broken file is treated as empty
+	 */
+	void Load();
+
+	/**
+	 * saves routes, if they changed since loaded
+	 */
+	bool Save();
+
+	/**
+	 * records that repo has package with the name
+	 */
+	void Add(std::string_view name, const std::string& repo);
+
+	/**
+	 * returns repos that likely contain package with the name, empty when
+	 * there is no route for it
+	 */
+	std::set<std::string> Lookup(std::string_view name) const;
+
+	static std::string_view NamePrefix(std::string_view name);
+
+private:
+	const std::string path;
+	std::unordered_map<std::string, std::set<std::string>> routes;
+	bool modified = false;
+};
@@ -1,41 +1,61 @@
 /* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <curl/curl.h>
 #include <errno.h>
 #include <memory>
+#include <optional>
 #include <stdio.h>
 #include <string.h>
 #include <string>
-#include <unordered_set>
+#include <thread>
+#include <vector>
+#include <zlib.h>
 
 #include "Downloader/CurlWrapper.h"
 #include "Downloader/Download.h"
+#include "Downloader/Http/IOThreadPool.h"
 #include "Downloader/IDownloader.h"
+#include "Downloader/ProgressTracker.h"
 #include "FileSystem/File.h"
-#include "FileSystem/FileData.h"
 #include "FileSystem/FileSystem.h"
 #include "FileSystem/HashGzip.h"
 #include "FileSystem/HashMD5.h"
+#include "FileSystem/Md5Set.h"
 #include "Logger.h"
 #include "RapidDownloader.h"
 #include "Sdp.h"
+#include "StringArena.h"
 #include "Tracer.h"
 #include "Util.h"
 
-CSdp::CSdp(std::string shortname_, std::string md5_, std::string name_,
-           std::vector<std::string> depends_, std::string baseUrl_)
-	: name(std::move(name_))
-	, md5(std::move(md5_))
-	, shortname(std::move(shortname_))
-	, baseUrl(std::move(baseUrl_))
-	, depends(std::move(depends_))
+CSdp::CSdp(std::shared_ptr<StringArena> arena_, std::string_view shortname_, std::string_view md5_,
+           std::string_view name_, const std::vector<std::string_view>& depends_,
+           std::string_view baseUrl_)
+	: arena(std::move(arena_))
+	, name(arena->intern(name_))
+	, md5(arena->intern(md5_))
+	, shortname(arena->intern(shortname_))
+	, baseUrl(arena->intern(baseUrl_))
 {
 	memset(cursize_buf, 0, LENGTH_SIZE);
-	const std::string dir =
-		fileSystem->getSpringDir() + PATH_DELIMITER + "packages" + PATH_DELIMITER;
-	finalSdpPath = dir + md5 + ".sdp";
-	tempSdpPath = finalSdpPath + ".incomplete";
+	depends.reserve(depends_.size());
+	for (std::string_view dep : depends_) {
+		depends.push_back(arena->intern(dep));
+	}
+}
+
+std::string CSdp::getFinalSdpPath() const
+{
+	return fileSystem->getSpringDir() + PATH_DELIMITER + "packages" + PATH_DELIMITER +
+	       std::string(md5) + ".sdp";
+}
+
+std::string CSdp::getTempSdpPath() const
+{
+	return getFinalSdpPath() + ".incomplete";
 }
 
 CSdp::CSdp(CSdp&& sdp) = default;
@@ -59,7 +79,7 @@ bool createPoolDirs(const std::string& root)
 
 std::unique_ptr<IDownload> CSdp::parseOrGetDownload()
 {
-	for (auto path : {finalSdpPath, tempSdpPath}) {
+	for (auto path : {getFinalSdpPath(), getTempSdpPath()}) {
 		if (!fileSystem->fileExists(path)) {
 			continue;
 		}
@@ -69,8 +89,8 @@ std::unique_ptr<IDownload> CSdp::parseOrGetDownload()
 		fileSystem->removeFile(path);
 		files.clear();
 	}
-	auto dl = std::make_unique<IDownload>(tempSdpPath);
-	dl->addMirror(baseUrl + "/packages/" + md5 + ".sdp");
+	auto dl = std::make_unique<IDownload>(getTempSdpPath());
+	dl->addMirror(std::string(baseUrl) + "/packages/" + std::string(md5) + ".sdp");
 	return dl;
 }
 
@@ -84,10 +104,80 @@ getDownloadsList(const std::vector<std::unique_ptr<IDownload>>& downloads)
 	return res;
 }
 
-static bool useStreamerDownload()
+enum class TransferMode {
+	STREAM,  // all files via streamer.cgi
+	HTTP,    // all files fetched individually from the pool
+	HYBRID,  // large files fetched individually, rest via streamer.cgi
+};
+
+static const char* transferModeName(TransferMode mode)
+{
+	switch (mode) {
+		case TransferMode::STREAM:
+			return "stream";
+		case TransferMode::HTTP:
+			return "http";
+		case TransferMode::HYBRID:
+			return "hybrid";
+	}
+	return "unknown";
+}
+
+// Returns the transfer mode forced by the user, if any.
+static std::optional<TransferMode> getForcedTransferMode()
 {
 	const char* use_streamer_env = std::getenv("PRD_RAPID_USE_STREAMER");
-	return use_streamer_env == nullptr || std::string(use_streamer_env) != "false";
+	if (use_streamer_env == nullptr || std::string(use_streamer_env) == "auto") {
+		return std::nullopt;
+	}
+	if (std::string(use_streamer_env) == "false") {
+		return TransferMode::HTTP;
+	}
+	return TransferMode::STREAM;
+}
+
+// Files at least this big are fetched over HTTP in automatic mode: the
+// request overhead is negligible for them and they can be downloaded in
+// parallel.
+constexpr uint64_t LARGE_FILE_SIZE = 4 * 1024 * 1024;
+// If there is less small files than this, it's not worth to use streamer.
+constexpr size_t MIN_STREAMED_FILES = 16;
+
+static bool isLargeFile(uint32_t size)
+{
+	return size >= LARGE_FILE_SIZE;
+}
+
+// Picks transfer mode for the package based on the number and size of files
+// missing from the pool.
+static TransferMode chooseTransferMode(const CSdp& sdp)
+{
+	size_t small_files = 0, large_files = 0;
+	uint64_t small_size = 0, large_size = 0;
+	const FileTable& files = sdp.files;
+	for (size_t i = files.nextDownload(0); i != FileTable::NPOS; i = files.nextDownload(i + 1)) {
+		const uint32_t size = files.fileSize(i);
+		if (isLargeFile(size)) {
+			large_files += 1;
+			large_size += size;
+		} else {
+			small_files += 1;
+			small_size += size;
+		}
+	}
+	TransferMode mode;
+	if (small_files < MIN_STREAMED_FILES) {
+		mode = TransferMode::HTTP;
+	} else if (large_files == 0) {
+		mode = TransferMode::STREAM;
+	} else {
+		mode = TransferMode::HYBRID;
+	}
+	LOG_INFO("%s: %zu small files (%.1f MiB), %zu large files (%.1f MiB) to download, using %s "
+	         "transfer",
+	         sdp.getShortName().data(), small_files, small_size / (1024.0 * 1024.0), large_files,
+	         large_size / (1024.0 * 1024.0), transferModeName(mode));
+	return mode;
 }
 
 bool CSdp::Download(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
@@ -124,13 +214,13 @@ bool CSdp::Download(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
 	std::vector<std::pair<CSdp*, IDownload*>> to_download;
 	{
 		TRACE("ComputePoolFilesToFetch");
-		const auto pool_files = fileSystem->getPoolFiles();
+		const auto pool_files = fileSystem->getPoolIndex().Load();
 		if (!pool_files) {
 			return false;
 		}
-		std::unordered_set<std::string> downloaded_md5;
-		for (const auto& [_, md5] : *pool_files) {
-			downloaded_md5.insert(md5.toString());
+		Md5Set downloaded_md5(pool_files->size());
+		for (const PoolIndex::Entry& entry : *pool_files) {
+			downloaded_md5.insert(entry.md5);
 		}
 		for (auto [pkg, dl] : packages) {
 			if (pkg->filterDownloaded(downloaded_md5)) {
@@ -141,28 +231,57 @@ bool CSdp::Download(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
 		}
 	}
 
-	// Do actual download.
-	if (useStreamerDownload()) {
-		for (auto [pkg, dl] : to_download) {
-			pkg->m_download = dl;
-			if (!pkg->downloadStream()) {
-				LOG_ERROR("Couldn't download files for %s", pkg->md5.c_str());
+	// Do actual download. Files are split between streamer and HTTP transfers
+	// by toggling their download flag before each of them.
+	{
+		Md5Set md5_to_download;
+		const auto forced_mode = getForcedTransferMode();
+		std::vector<std::pair<FileTable*, size_t>> http_files, stream_files;
+		const auto setDownload = [](const std::vector<std::pair<FileTable*, size_t>>& files,
+		                            bool download) {
+			for (auto [table, i] : files) {
+				table->setDownload(i, download);
+			}
+		};
+		for (auto [pkg, _] : to_download) {
+			FileTable& files = pkg->files;
+			// Multiple packages can reference the same pool file, it must be
+			// downloaded only once.
+			for (size_t i = files.nextDownload(0); i != FileTable::NPOS;
+			     i = files.nextDownload(i + 1)) {
+				files.setDownload(i, md5_to_download.insert(files.md5(i)));
+			}
+			const TransferMode mode = forced_mode ? *forced_mode : chooseTransferMode(*pkg);
+			for (size_t i = files.nextDownload(0); i != FileTable::NPOS;
+			     i = files.nextDownload(i + 1)) {
+				if (mode == TransferMode::HTTP ||
+				    (mode == TransferMode::HYBRID && isLargeFile(files.fileSize(i)))) {
+					http_files.emplace_back(&files, i);
+				} else {
+					stream_files.emplace_back(&files, i);
+				}
+			}
+		}
+
+		if (!http_files.empty()) {
+			setDownload(stream_files, false);
+			if (!downloadHTTP(to_download)) {
 				return false;
 			}
-			dl->state = IDownload::STATE_FINISHED;
+			setDownload(http_files, false);
+			setDownload(stream_files, true);
 		}
-	} else {
-		if (!downloadHTTP(to_download)) {
+		if (!stream_files.empty() && !downloadStream(to_download)) {
 			return false;
 		}
-		for (auto [pkg, dl] : to_download) {
-			dl->state = IDownload::STATE_FINISHED;
-		}
+	}
+	for (auto [pkg, dl] : to_download) {
+		dl->state = IDownload::STATE_FINISHED;
 	}
 
 	for (auto [pkg, dl] : packages) {
-		if (dl->state == IDownload::STATE_FINISHED && fileSystem->fileExists(pkg->tempSdpPath) &&
-		    !fileSystem->Rename(pkg->tempSdpPath, pkg->finalSdpPath)) {
+		if (dl->state == IDownload::STATE_FINISHED && fileSystem->fileExists(pkg->getTempSdpPath()) &&
+		    !fileSystem->Rename(pkg->getTempSdpPath(), pkg->getFinalSdpPath())) {
 			return false;
 		}
 	}
@@ -170,55 +289,77 @@ bool CSdp::Download(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
 	return true;
 }
 
-bool CSdp::filterDownloaded(std::unordered_set<std::string> const& downloaded_md5)
+bool CSdp::filterDownloaded(Md5Set const& downloaded_md5)
 {
 	TRACE();
 	bool need_to_download = false;
-	for (FileData& filedata : files) {  // check which file are available on local
-		                                // disk -> create list of files to download
-		HashMD5 fileMd5;
-		fileMd5.Set(filedata.md5, sizeof(filedata.md5));
-		if (downloaded_md5.find(fileMd5.toString()) == downloaded_md5.end()) {
-			need_to_download = true;
-			filedata.download = true;
-		} else {
-			filedata.download = false;
-		}
+	// check which file are available on local disk -> create list of files to download
+	for (size_t i = 0; i < files.size(); ++i) {
+		const bool download = !downloaded_md5.contains(files.md5(i));
+		files.setDownload(i, download);
+		need_to_download |= download;
 	}
 	return need_to_download;
 }
 
+// Submits work operating on the stream files to the IO thread of the package.
+// on_success is executed on the main thread after work finished successfully.
+template <class F>
+static void submitIO(CSdp& sdp, F&& f, IOThreadPool::OptRetF on_success = std::nullopt)
+{
+	sdp.thread_handle->submit([psdp = &sdp, f = std::forward<F>(f),
+	                           on_success = std::move(on_success)]() -> IOThreadPool::OptRetF {
+		if (psdp->io_failure) {
+			return std::nullopt;
+		}
+		if (!f(*psdp)) {
+			psdp->io_failure = true;
+			return [psdp] { *psdp->abort_download = true; };
+		}
+		return on_success;
+	});
+}
+
 static bool OpenNextFile(CSdp& sdp)
 {
 	// file already open, return
-	if (sdp.file_handle != nullptr) {
+	if (sdp.file_open) {
 		return true;
 	}
 
 	// get next file + open it
-	while (!sdp.list_it->download) {
-		// LOG_ERROR("next file");
-		sdp.list_it++;
+	sdp.file_index = sdp.files.nextDownload(sdp.file_index);
+	if (sdp.file_index == FileTable::NPOS) {
+		LOG_ERROR("Received more files than requested for %s", sdp.getMD5().data());
+		return false;
 	}
-	assert(sdp.list_it != sdp.files.end());
-
-	HashMD5 fileMd5;
-	FileData& fd = *(sdp.list_it);
-
-	fd.compsize = parse_int32(sdp.cursize_buf);
-	// LOG_DEBUG("Read length of %d, uncompressed size from sdp: %d", fd.compsize, fd.size);
-	assert(fd.size + 5000 >=
-	       fd.compsize);  // compressed file should be smaller than uncompressed file
 
-	fileMd5.Set(fd.md5, sizeof(fd.md5));
-	sdp.file_name = fileSystem->getPoolFilename(fileMd5.toString());
-	sdp.file_handle = std::unique_ptr<CFile>(new CFile());
-	if (sdp.file_handle == nullptr) {
-		LOG_ERROR("couldn't open %s", fd.name.c_str());
+	sdp.cursize = parse_int32(sdp.cursize_buf);
+	// LOG_DEBUG("Read length of %d, uncompressed size from sdp: %d", sdp.cursize, size);
+	assert(sdp.files.fileSize(sdp.file_index) + 5000 >=
+	       sdp.cursize);  // compressed file should be smaller than uncompressed file
+	if (sdp.cursize == 0) {  //.gz are always > 0
+		const std::string_view name = sdp.files.name(sdp.file_index);
+		LOG_ERROR("Received empty file %.*s", (int)name.size(), name.data());
 		return false;
 	}
-	sdp.file_handle->Open(sdp.file_name);
+
+	HashMD5 fileMd5;
+	fileMd5.Set(sdp.files.md5(sdp.file_index), FileTable::MD5_SIZE);
+	sdp.file_name = fileSystem->getPoolFilename(fileMd5.toString());
 	sdp.file_pos = 0;
+	sdp.file_open = true;
+
+	submitIO(sdp, [file_name = sdp.file_name](CSdp& sdp) {
+		assert(sdp.file_handle == nullptr);
+		sdp.file_handle = std::make_unique<CFile>();
+		if (!sdp.file_handle->Open(file_name)) {
+			sdp.file_handle = nullptr;
+			return false;
+		}
+		sdp.file_hash->Init();
+		return true;
+	});
 	return true;
 }
 
@@ -239,44 +380,62 @@ static int GetLength(CSdp& sdp, const char* const buf_pos, const char* const buf
 	return toskip;
 }
 
-static void SafeCloseFile(CSdp& sdp)
+// Closes the file currently being written by the IO thread, if any. Executed
+// when the transfer ends, so whatever is still open is incomplete.
+static void DiscardOpenFile(CSdp& sdp)
 {
-	if (sdp.file_handle == nullptr)
-		return;
-
-	sdp.file_handle->Close();
-	sdp.file_handle = nullptr;
+	sdp.thread_handle->submit([psdp = &sdp]() -> IOThreadPool::OptRetF {
+		if (psdp->file_handle != nullptr) {
+			psdp->file_handle->Close(/*discard=*/true);
+			psdp->file_handle = nullptr;
+		}
+		return std::nullopt;
+	});
+	sdp.file_open = false;
 	sdp.file_pos = 0;
 	sdp.skipped = 0;
 }
 
-static int WriteData(CSdp& sdp, const char* const buf_pos, const char* const buf_end)
+static int WriteData(CSdp& sdp, const std::shared_ptr<char[]>& buffer, const char* const buf_pos,
+                     const char* const buf_end)
 {
 	// minimum of bytes to write left in file and bytes to write left in buf
-	const FileData& fd = *(sdp.list_it);
-	const long towrite = intmin(fd.compsize - sdp.file_pos, buf_end - buf_pos);
-	//	LOG_DEBUG("towrite: %d total size: %d, uncomp size: %d pos: %d", towrite,
-	// fd.compsize,fd.size, sdp.file_pos);
+	const long towrite = intmin(sdp.cursize - sdp.file_pos, buf_end - buf_pos);
+	//	LOG_DEBUG("towrite: %d total size: %d pos: %d", towrite, sdp.cursize, sdp.file_pos);
 	assert(towrite >= 0);
-	assert(fd.compsize > 0);  //.gz are always > 0
 	if (towrite == 0) {
 		return 0;
 	}
 
-	if (!sdp.file_handle->Write(buf_pos, towrite)) {
-		return -1;
-	}
+	// The data is verified while it's being written, so that the file
+	// doesn't need to be read back from disk after it's done.
+	submitIO(sdp, [buffer, buf_pos, towrite](CSdp& sdp) {
+		sdp.file_hash->Update(buf_pos, towrite);
+		return sdp.file_handle->Write(buf_pos, towrite);
+	});
 	sdp.file_pos += towrite;
 
 	// file finished -> next file
-	if (sdp.file_pos >= fd.compsize) {
-		SafeCloseFile(sdp);
-		if (!fileSystem->fileIsValid(&fd, sdp.file_name.c_str())) {
-			LOG_ERROR("File is broken?!: %s", sdp.file_name.c_str());
-			fileSystem->removeFile(sdp.file_name.c_str());
-			return -1;
-		}
-		++sdp.list_it;
+	if (sdp.file_pos >= sdp.cursize) {
+		HashMD5 fileMd5;
+		fileMd5.Set(sdp.files.md5(sdp.file_index), FileTable::MD5_SIZE);
+		submitIO(sdp, [fileMd5, file_name = sdp.file_name](CSdp& sdp) {
+			sdp.file_hash->Final();
+			const bool valid = sdp.file_hash->compare(&fileMd5);
+			if (!valid) {
+				LOG_ERROR("File is broken?!: %s", file_name.c_str());
+			}
+			const bool closed = sdp.file_handle->Close(/*discard=*/!valid);
+			sdp.file_handle = nullptr;
+			return valid && closed;
+		}, [psdp = &sdp, i = sdp.file_index] {
+			// File is in the pool, don't request it again when retrying.
+			psdp->files.setDownload(i, false);
+		});
+		sdp.file_open = false;
+		sdp.file_pos = 0;
+		sdp.skipped = 0;
+		++sdp.file_index;
 		memset(sdp.cursize_buf, 0, 4);  // safety
 	}
 	return towrite;
@@ -284,7 +443,7 @@ static int WriteData(CSdp& sdp, const char* const buf_pos, const char* const buf
 
 void dump_data(CSdp& sdp, const char* const /*buf_pos*/, const char* const /*buf_end*/)
 {
-	LOG_WARN("%s %d\n", sdp.file_name.c_str(), sdp.list_it->compsize);
+	LOG_WARN("%s %d\n", sdp.file_name.c_str(), sdp.cursize);
 }
 
 
@@ -305,7 +464,12 @@ static size_t write_streamed_data(const void* buf, size_t size, size_t nmemb, CS
 
 	if (IDownloader::AbortDownloads())
 		return -1;
-	const char* buf_start = (const char*)buf;
+
+	// shared_ptr because std::function must be copyable.
+	auto buffer = std::shared_ptr<char[]>(new char[size * nmemb]);
+	memcpy(buffer.get(), buf, size * nmemb);
+
+	const char* buf_start = buffer.get();
 	const char* buf_end = buf_start + size * nmemb;
 	const char* buf_pos = buf_start;
 
@@ -327,10 +491,10 @@ static size_t write_streamed_data(const void* buf, size_t size, size_t nmemb, CS
 		if (!OpenNextFile(sdp))
 			return -1;
 
-		assert(sdp.file_handle != nullptr);
-		assert(sdp.list_it != sdp.files.end());
+		assert(sdp.file_open);
+		assert(sdp.file_index < sdp.files.size());
 
-		const int written = WriteData(sdp, buf_pos, buf_end);
+		const int written = WriteData(sdp, buffer, buf_pos, buf_end);
 		if (written < 0) {
 			dump_data(sdp, buf_pos, buf_end);
 			return -1;
@@ -348,112 +512,292 @@ static int progress_func(CSdp& sdp, curl_off_t TotalToDownload, curl_off_t NowDo
 {
 	if (IDownloader::AbortDownloads())
 		return -1;
-	sdp.m_download->rapid_size[&sdp] = TotalToDownload;
-	sdp.m_download->map_rapid_progress[&sdp] = NowDownloaded;
-	uint64_t total = 0;
-	for (auto it : sdp.m_download->rapid_size) {
-		total += it.second;
-	}
-	sdp.m_download->size = total;
-	if (IDownloader::listener != nullptr) {
-		IDownloader::listener(NowDownloaded, TotalToDownload);
-	}
-	total = 0;
-	for (auto it : sdp.m_download->map_rapid_progress) {
-		total += it.second;
-	}
-	sdp.m_download->updateProgress(total);
-	if (TotalToDownload == NowDownloaded)  // force output when download is
-	                                       // finished
-		LOG_PROGRESS(NowDownloaded, TotalToDownload, true);
-	else
-		LOG_PROGRESS(NowDownloaded, TotalToDownload);
+	// Only differences to the previous call are added, so that the cost
+	// doesn't depend on the number of packages.
+	const int64_t total_delta = TotalToDownload - sdp.stream_total;
+	const int64_t done_delta = NowDownloaded - sdp.stream_done;
+	sdp.stream_total = TotalToDownload;
+	sdp.stream_done = NowDownloaded;
+	IDownload* dl = sdp.m_download;
+	dl->size = std::max<int64_t>(dl->size, 0) + total_delta;
+	dl->updateProgress(dl->getProgress() + done_delta);
+	sdp.progress->addTotal(total_delta);
+	sdp.progress->addDone(done_delta);
+	sdp.progress->report();
 	return 0;
 }
 
-bool CSdp::downloadStream()
+bool CSdp::setupStream(CURLM* curlm)
 {
 	TRACE();
-	std::string downloadUrl = baseUrl + "/streamer.cgi?" + md5;
-	CurlWrapper curlw;
-
-	CURLcode res;
+	const std::string downloadUrl = std::string(baseUrl) + "/streamer.cgi?" + std::string(md5);
 	LOG_INFO("Using rapid");
 	LOG_INFO(downloadUrl.c_str());
 
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_URL, downloadUrl.c_str());
-
-	SafeCloseFile(*this);
-
-	list_it = files.begin();
+	file_index = 0;
 	file_name = "";
+	file_open = false;
+	file_pos = 0;
+	skipped = 0;
 
 	const int buflen = (files.size() / 8) + 1;
 	std::vector<char> buf(buflen, 0);
 
-	int i = 0;
-	for (FileData& fd : files) {
-		if (fd.download) {
-			buf[i / 8] |= (1 << (i % 8));
-		}
-		i++;
+	for (size_t i = files.nextDownload(0); i != FileTable::NPOS; i = files.nextDownload(i + 1)) {
+		buf[i / 8] |= (1 << (i % 8));
 	}
 
 	int destlen = files.size() * 2 + 1024;
-	std::vector<char> dest(destlen, 0);
+	stream_request.assign(destlen, 0);
 	LOG_DEBUG("Files: %d Buflen: %d Destlen: %d", (int)files.size(), buflen, destlen);
 
-	gzip_str(&buf[0], buflen, &dest[0], &destlen);
+	if (gzip_str(&buf[0], buflen, &stream_request[0], &destlen) != Z_OK) {
+		return false;
+	}
+	stream_request.resize(destlen);
+
+	file_hash = std::make_unique<HashGzip>(std::make_unique<HashMD5>());
+	curlw = std::make_unique<CurlWrapper>();
+	CURL* curle = curlw->GetHandle();
+	curl_easy_setopt(curle, CURLOPT_URL, downloadUrl.c_str());
+	curl_easy_setopt(curle, CURLOPT_PRIVATE, this);
+	curl_easy_setopt(curle, CURLOPT_WRITEFUNCTION, write_streamed_data);
+	curl_easy_setopt(curle, CURLOPT_WRITEDATA, this);
+	curl_easy_setopt(curle, CURLOPT_POSTFIELDS, &stream_request[0]);
+	curl_easy_setopt(curle, CURLOPT_POSTFIELDSIZE, destlen);
+	curl_easy_setopt(curle, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curle, CURLOPT_XFERINFOFUNCTION, progress_func);
+	curl_easy_setopt(curle, CURLOPT_XFERINFODATA, this);
+
+	const CURLMcode ret = curl_multi_add_handle(curlm, curle);
+	if (ret != CURLM_OK) {
+		LOG_ERROR("curl_multi_add_handle failed, code %d.", ret);
+		curlw = nullptr;
+		return false;
+	}
+	return true;
+}
 
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_WRITEFUNCTION, write_streamed_data);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_WRITEDATA, this);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_POSTFIELDS, &dest[0]);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_POSTFIELDSIZE, destlen);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_NOPROGRESS, 0L);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_XFERINFOFUNCTION, progress_func);
-	curl_easy_setopt(curlw.GetHandle(), CURLOPT_XFERINFODATA, this);
+static void cleanupStream(CURLM* curlm, CSdp& sdp)
+{
+	if (sdp.curlw == nullptr) {
+		return;
+	}
+	curl_multi_remove_handle(curlm, sdp.curlw->GetHandle());
+	sdp.curlw = nullptr;
+	// Files are closed as soon as they are fully written, whatever is still
+	// open at this point is incomplete.
+	DiscardOpenFile(sdp);
+}
 
-	res = curl_easy_perform(curlw.GetHandle());
+// Transfer errors after which it makes sense to request remaining files again.
+static bool isRetryableStreamError(CURLcode code)
+{
+	switch (code) {
+		case CURLE_OK:  // Streamer closed the response before sending all files.
+		case CURLE_PARTIAL_FILE:
+		case CURLE_RECV_ERROR:
+		case CURLE_SEND_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_HTTP2:
+		case CURLE_HTTP2_STREAM:
+			return true;
+		default:
+			return false;
+	}
+}
 
-	SafeCloseFile(*this);
+// Marks the stream to be retried. The retry can happen only after all results of the IO work
+// submitted for the previous request were processed, so that files that got into the pool are
+// no longer marked for download.
+static void scheduleStreamRetry(CSdp& sdp)
+{
+	using namespace std::chrono_literals;
+	++sdp.stream_retry_num;
+	sdp.stream_next_retry =
+		std::chrono::steady_clock::now() + retryAfter(sdp.stream_retry_num, 500ms, 10s);
+	sdp.stream_flushed = false;
+	sdp.thread_handle->submit([psdp = &sdp]() -> IOThreadPool::OptRetF {
+		return [psdp] { psdp->stream_flushed = true; };
+	});
+}
 
-	/* always cleanup */
-	if (res != CURLE_OK) {
-		LOG_ERROR("Curl error: %s", curl_easy_strerror(res));
-		return false;
+bool CSdp::downloadStream(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
+{
+	TRACE();
+	std::vector<CSdp*> streams;
+	for (auto [pkg, dl] : packages) {
+		pkg->m_download = dl;
+		if (pkg->files.hasDownloads()) {
+			streams.push_back(pkg);
+		}
+	}
+
+	if (streams.empty()) {
+		return true;
 	}
 
+	// Writing and verification of pool files happens on IO threads, each
+	// package is assigned a single thread to keep its writes in order.
+	const unsigned pool_size = std::clamp(
+		std::min(static_cast<unsigned>(streams.size()), std::thread::hardware_concurrency()), 1u,
+		16u);
+	IOThreadPool thread_pool(pool_size, 1000);
+	bool abort_download = false;
+	ProgressTracker progress;
+
+	std::lock_guard<std::recursive_mutex> curlm_lock(CurlWrapper::GetMultiHandleMutex());
+	CURLM* curlm = CurlWrapper::GetMultiHandle();
+	bool ok = true;
+	for (CSdp* sdp : streams) {
+		sdp->thread_handle.emplace(thread_pool.getHandle());
+		sdp->abort_download = &abort_download;
+		sdp->io_failure = false;
+		sdp->stream_retry_num = 0;
+		sdp->progress = &progress;
+		sdp->stream_total = 0;
+		sdp->stream_done = 0;
+		if (!sdp->setupStream(curlm)) {
+			ok = false;
+			break;
+		}
+	}
 
-	return true;
+	constexpr int stream_retry_limit = 3;
+	std::vector<CSdp*> to_retry;
+	std::vector<CSdp*> http_fallback;
+	int running = 0;
+	while (ok) {
+		CURLMcode ret = curl_multi_perform(curlm, &running);
+		if (ret != CURLM_OK) {
+			LOG_ERROR("curl_multi_perform failed, code %d.", ret);
+			ok = false;
+			break;
+		}
+		int msgs_left;
+		while (struct CURLMsg* msg = curl_multi_info_read(curlm, &msgs_left)) {
+			if (msg->msg != CURLMSG_DONE) {
+				LOG_ERROR("Unhandled message %d", msg->msg);
+				continue;
+			}
+			CSdp* sdp;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &sdp);
+			const CURLcode result = msg->data.result;
+			const bool complete = result == CURLE_OK && !sdp->file_open && sdp->skipped == 0 &&
+			                      !sdp->files.hasDownloads(sdp->file_index);
+			if (!complete) {
+				if (result == CURLE_OK) {
+					LOG_WARN("Streamer didn't send all files for %s", sdp->md5.data());
+				} else {
+					LOG_WARN("Couldn't download files for %s, curl error: %s (%s)",
+					         sdp->md5.data(), curl_easy_strerror(result),
+					         sdp->curlw->GetError().c_str());
+				}
+			}
+			cleanupStream(curlm, *sdp);
+			if (complete) {
+				continue;
+			}
+			if (!isRetryableStreamError(result)) {
+				LOG_ERROR("Downloading files for %s failed", sdp->md5.data());
+				ok = false;
+				continue;
+			}
+			scheduleStreamRetry(*sdp);
+			if (sdp->stream_retry_num > stream_retry_limit) {
+				LOG_WARN("Limit of streamer retries (%d) reached for %s, falling back to HTTP",
+				         stream_retry_limit, sdp->md5.data());
+				http_fallback.push_back(sdp);
+			} else {
+				to_retry.push_back(sdp);
+			}
+		}
+		if (!ok || (running == 0 && to_retry.empty())) {
+			break;
+		}
+		ret = curl_multi_poll(curlm, NULL, 0, 20, NULL);
+		if (ret != CURLM_OK) {
+			LOG_ERROR("curl_multi_poll, code %d.", ret);
+			ok = false;
+		}
+
+		thread_pool.pullResults();
+		if (abort_download) {
+			ok = false;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		for (auto it = to_retry.begin(); ok && it != to_retry.end();) {
+			CSdp* sdp = *it;
+			if (!sdp->stream_flushed || sdp->stream_next_retry > now) {
+				++it;
+				continue;
+			}
+			it = to_retry.erase(it);
+			if (!sdp->files.hasDownloads()) {
+				continue;
+			}
+			LOG_INFO("Retrying streamer request for %s (retry %d)", sdp->md5.data(),
+			         sdp->stream_retry_num);
+			if (!sdp->setupStream(curlm)) {
+				ok = false;
+			}
+		}
+	}
+
+	for (CSdp* sdp : streams) {
+		cleanupStream(curlm, *sdp);
+	}
+	thread_pool.finish();
+	// Last update might have been throttled.
+	progress.report(/*force=*/true);
+	for (CSdp* sdp : streams) {
+		sdp->thread_handle.reset();
+		sdp->abort_download = nullptr;
+		sdp->progress = nullptr;
+	}
+	ok = ok && !abort_download;
+
+	// IO threads are finished, so only files that are not in the pool are left marked.
+	if (ok && !http_fallback.empty()) {
+		std::vector<std::pair<CSdp*, IDownload*>> http_packages;
+		for (CSdp* sdp : http_fallback) {
+			http_packages.emplace_back(sdp, sdp->m_download);
+		}
+		ok = downloadHTTP(http_packages);
+	}
+	return ok;
 }
 
 std::string CSdp::getPoolFileUrl(const std::string& md5s) const
 {
-	return baseUrl + "/pool/" + md5s.substr(0, 2) + "/" + md5s.substr(2) + ".gz";
+	return std::string(baseUrl) + "/pool/" + md5s.substr(0, 2) + "/" + md5s.substr(2) + ".gz";
 }
 
 bool CSdp::downloadHTTP(std::vector<std::pair<CSdp*, IDownload*>> const& packages)
 {
 	TRACE();
-	std::unordered_set<std::string> md5_in_queue;
+	Md5Set md5_in_queue;
 	std::list<IDownload*> dls;
 	for (auto [pkg, _] : packages) {
-		for (FileData& fd : pkg->files) {
-			if (!fd.download)
-				continue;
-			auto fileMd5 = std::make_unique<HashMD5>();
-			fileMd5->Set(fd.md5, sizeof(fd.md5));
+		const FileTable& files = pkg->files;
+		for (size_t i = files.nextDownload(0); i != FileTable::NPOS;
+		     i = files.nextDownload(i + 1)) {
 			// Multiple files in sdp can map to a single file in the pool,
 			// we need to skip duplicates.
-			if (md5_in_queue.find(fileMd5->toString()) != md5_in_queue.end()) {
+			if (!md5_in_queue.insert(files.md5(i))) {
 				continue;
 			}
-			md5_in_queue.insert(fileMd5->toString());
-			std::string url = pkg->getPoolFileUrl(fileMd5->toString());
-			std::string filename = fileSystem->getPoolFilename(fileMd5->toString());
+			auto fileMd5 = std::make_unique<HashMD5>();
+			fileMd5->Set(files.md5(i), FileTable::MD5_SIZE);
+			const std::string md5str = fileMd5->toString();
+			std::string url = pkg->getPoolFileUrl(md5str);
+			std::string filename = fileSystem->getPoolFilename(md5str);
 			IDownload* dl = new IDownload(filename);
 			dl->addMirror(url);
-			dl->approx_size = fd.size;
+			dl->approx_size = files.fileSize(i);
 			dl->hash = std::move(fileMd5);
 			dl->out_hash = std::make_unique<HashGzip>(std::make_unique<HashMD5>());
 			dls.push_back(dl);
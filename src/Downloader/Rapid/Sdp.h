@@ -2,23 +2,36 @@
 
 #pragma once
 
+#include <chrono>
+#include <curl/curl.h>
 #include <memory>
+#include <optional>
 #include <string>
-#include <unordered_set>
+#include <string_view>
 #include <vector>
 
-#include "FileSystem/FileData.h"
+#include "Downloader/Http/IOThreadPool.h"
+#include "FileSystem/FileTable.h"
 
 #define LENGTH_SIZE 4
 
 class IDownload;
 class CFile;
+class CurlWrapper;
+class IHash;
+class Md5Set;
+class ProgressTracker;
+class StringArena;
 
 class CSdp
 {
 public:
-	CSdp(std::string shortname, std::string md5, std::string name, std::vector<std::string> depends,
-	     std::string baseUrl);
+	/**
+	 * strings are stored in arena, which is shared by all packages of a repo
+	 */
+	CSdp(std::shared_ptr<StringArena> arena, std::string_view shortname, std::string_view md5,
+	     std::string_view name, const std::vector<std::string_view>& depends,
+	     std::string_view baseUrl);
 	CSdp(CSdp&& sdp);
 
 	~CSdp();
@@ -27,42 +40,59 @@ public:
 	/**
 	 * returns md5 of a repo
 	 */
-	const std::string& getMD5() const
+	std::string_view getMD5() const
 	{
 		return md5;
 	}
 	/**
 	 * returns the descriptional name
 	 */
-	const std::string& getName() const
+	std::string_view getName() const
 	{
 		return name;
 	}
 	/**
 	 * returns the shortname, for example ba:stable
 	 */
-	const std::string& getShortName() const
+	std::string_view getShortName() const
 	{
 		return shortname;
 	}
 	/**
 	 * returns the shortname, for example ba:stable
 	 */
-	const std::vector<std::string>& getDepends() const
+	const std::vector<std::string_view>& getDepends() const
 	{
 		return depends;
 	}
 
 	IDownload* m_download = nullptr;
-	std::vector<FileData>::iterator list_it;
-	std::vector<FileData> files;  // list with all files of an sdp
-	std::unique_ptr<CFile> file_handle;
+	size_t file_index = 0;  // file currently being received from the streamer
+	FileTable files;        // list with all files of an sdp
+	std::unique_ptr<CurlWrapper> curlw;  // streamer request, when in progress
 	std::string file_name;
+	bool file_open = false;
 
 	unsigned int file_pos = 0;
 	unsigned int skipped = 0;
 	unsigned char cursize_buf[LENGTH_SIZE];
-	unsigned int cursize = 0;
+	unsigned int cursize = 0;  // compressed size of the file being received
+
+	std::optional<IOThreadPool::Handle> thread_handle;
+	std::unique_ptr<CFile> file_handle;  // Used by IO threads
+	std::unique_ptr<IHash> file_hash;    // Used by IO threads
+	bool io_failure = false;             // Used by IO threads
+	bool* abort_download = nullptr;
+
+	// State of retries of interrupted streamer requests
+	int stream_retry_num = 0;
+	std::chrono::steady_clock::time_point stream_next_retry;
+	bool stream_flushed = false;  // all IO work for the previous request finished
+
+	// Progress of all streamer requests and the last values reported by curl for this one
+	ProgressTracker* progress = nullptr;
+	int64_t stream_total = 0;
+	int64_t stream_done = 0;
 
 private:
 	/**
@@ -75,7 +105,7 @@ private:
 	 * Marks entries from `files` list to download or not depending on whatever there is entry is
 	 * present in downloaded_md5 set. Returns true if there are any files to download.
 	 */
-	bool filterDownloaded(std::unordered_set<std::string> const& downloaded_md5);
+	bool filterDownloaded(Md5Set const& downloaded_md5);
 
 	void parse();
 	/**
@@ -95,16 +125,31 @@ private:
 	 *   in the .sdp, the sdp-file contains the uncompressed size
 	 * - streamer.cgi also sets the Content-Length header in the reply so you can implement a proper
 	 *   progress bar.
+	 *
+	 * All packages are requested at the same time and driven by a single curl multi loop. A pool
+	 * file present in multiple packages must be marked for download only in one of them.
+	 *
+	 * When the transfer is interrupted, the request is repeated with backoff for files that were
+	 * not yet written to the pool, and after too many failures the remaining files are fetched
+	 * from the pool over HTTP.
 	 */
-	bool downloadStream();
+	static bool downloadStream(std::vector<std::pair<CSdp*, IDownload*>> const& packages);
+	/**
+	 * Prepares the streamer request for all files marked for download and adds it to curlm.
+	 */
+	bool setupStream(CURLM* curlm);
 	std::string getPoolFileUrl(const std::string& md5str) const;
 	static bool downloadHTTP(std::vector<std::pair<CSdp*, IDownload*>> const& packages);
 
-	std::string name;
-	std::string md5;
-	std::string shortname;
-	std::string baseUrl;
-	std::string tempSdpPath;
-	std::string finalSdpPath;
-	std::vector<std::string> depends;
+	std::string getFinalSdpPath() const;
+	std::string getTempSdpPath() const;
+
+	// All views point into arena and are NUL terminated.
+	std::shared_ptr<StringArena> arena;
+	std::string_view name;
+	std::string_view md5;
+	std::string_view shortname;
+	std::string_view baseUrl;
+	std::vector<std::string_view> depends;
+	std::vector<char> stream_request;  // gzipped bitarray posted to streamer.cgi
 };
@@ -0,0 +1,28 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "StringArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::string_view StringArena::intern(std::string_view str)
+{
+	if (auto it = strings.find(str); it != strings.end()) {
+		return *it;
+	}
+	const size_t needed = str.size() + 1;
+	if (needed > left) {
+		// Strings longer than a block get a block of their own.
+		const size_t size = std::max(needed, BLOCK_SIZE);
+		blocks.emplace_back(new char[size]);
+		pos = blocks.back().get();
+		left = size;
+	}
+	memcpy(pos, str.data(), str.size());
+	pos[str.size()] = '\0';
+	const std::string_view res(pos, str.size());
+	pos += needed;
+	left -= needed;
+	strings.insert(res);
+	return res;
+}
@@ -0,0 +1,38 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Storage for many small immutable strings.
+ *
+ * Strings are copied into large blocks, so that storing them doesn't need an
+ * allocation per string, and equal strings are stored only once. Returned
+ * views stay valid for the lifetime of the arena and are NUL terminated, so
+ * data() can be passed to C functions.
+ */
+class StringArena
+{
+public:
+	StringArena() = default;
+	StringArena(const StringArena&) = delete;
+	StringArena& operator=(const StringArena&) = delete;
+
+	/**
+	 * returns view of a copy of str owned by the arena
+	 */
+	std::string_view intern(std::string_view str);
+
+private:
+	static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* pos = nullptr;
+	size_t left = 0;
+	std::unordered_set<std::string_view> strings;
+};
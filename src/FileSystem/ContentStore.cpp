@@ -0,0 +1,69 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "ContentStore.h"
+
+#include "FileSystem.h"
+#include "Logger.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+ContentStore::ContentStore(std::string dir_)
+	: dir(std::move(dir_))
+{
+}
+
+std::string ContentStore::KeyPath(uint64_t size, uint32_t crc, int mode) const
+{
+	// Files with the same key are told apart by their md5, so that files
+	// with colliding CRC32 are never mixed up. Keys are spread over 256
+	// directories by the first byte of the CRC.
+	char name[64];
+	snprintf(name, sizeof(name), "%02x%c%08x-%" PRIu64 "-%o", crc >> 24, PATH_DELIMITER, crc, size,
+	         mode & 07777);
+	return dir + PATH_DELIMITER + name;
+}
+
+bool ContentStore::Contains(uint64_t size, uint32_t crc, int mode) const
+{
+	return CFileSystem::directoryExists(KeyPath(size, crc, mode));
+}
+
+bool ContentStore::Link(uint64_t size, uint32_t crc, int mode, const std::string& md5,
+                        const std::string& path) const
+{
+	const std::string entry = KeyPath(size, crc, mode) + PATH_DELIMITER + md5;
+	if (!CFileSystem::fileExists(entry)) {
+		return false;
+	}
+	if (!CFileSystem::fileMatchesCrc32(entry, size, crc)) {
+		LOG_WARN("Removing modified file from store: %s", entry.c_str());
+		CFileSystem::removeFile(entry);
+		return false;
+	}
+	std::error_code ec;
+	std::filesystem::create_hard_link(u8ToPath(entry), u8ToPath(path), ec);
+	if (ec) {
+		LOG_DEBUG("Failed to link %s to %s: %s", entry.c_str(), path.c_str(),
+		          ec.message().c_str());
+		return false;
+	}
+	return true;
+}
+
+void ContentStore::Add(uint64_t size, uint32_t crc, int mode, const std::string& md5,
+                       const std::string& path) const
+{
+	const std::string key = KeyPath(size, crc, mode);
+	const std::string entry = key + PATH_DELIMITER + md5;
+	std::error_code ec;
+	std::filesystem::create_directories(u8ToPath(key), ec);
+	// Fails when the same content was stored by another thread, that's fine.
+	std::filesystem::create_hard_link(u8ToPath(path), u8ToPath(entry), ec);
+	if (ec && ec != std::errc::file_exists) {
+		LOG_DEBUG("Failed to store %s as %s: %s", path.c_str(), entry.c_str(),
+		          ec.message().c_str());
+	}
+}
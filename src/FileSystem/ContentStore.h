@@ -0,0 +1,51 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Content addressed store of extracted files.
+ *
+ * Consecutive engine versions share most of their files, so instead of a
+ * full copy per version, every extracted file is hardlinked into the store
+ * under its size, CRC32, mode and md5. When an archive entry with the same
+ * size, CRC32 and mode is stored already, the entry is only decompressed to
+ * compute its md5, and the stored file with that md5 is linked instead of
+ * writing it. Stored files are checked against their CRC32 before linking,
+ * so that a file modified in place in one of the versions doesn't spread to
+ * the others.
+ *
+ * Files are never removed from the store, so removing an engine version
+ * doesn't free space of files it shared with the store. Store has to be on
+ * the same filesystem as extracted files. Thread safe.
+ */
+class ContentStore
+{
+public:
+	explicit ContentStore(std::string dir);
+
+	/**
+	 * returns whether any file with given size, crc and mode is stored, only then Link can succeed
+	 */
+	bool Contains(uint64_t size, uint32_t crc, int mode) const;
+
+	/**
+	 * creates path as a link to the stored file, path must not exist. Returns false if the file
+	 * isn't stored or can't be linked.
+	 */
+	bool Link(uint64_t size, uint32_t crc, int mode, const std::string& md5,
+	          const std::string& path) const;
+
+	/**
+	 * adds the extracted file at path to the store, unless it's already stored
+	 */
+	void Add(uint64_t size, uint32_t crc, int mode, const std::string& md5,
+	         const std::string& path) const;
+
+private:
+	std::string KeyPath(uint64_t size, uint32_t crc, int mode) const;
+
+	const std::string dir;
+};
@@ -10,6 +10,7 @@
 #include "File.h"
 #include "FileSystem.h"
 #include "Logger.h"
+#include "PoolIndex.h"
 
 CFile::~CFile()
 {
@@ -28,11 +29,16 @@ bool CFile::Close(bool discard)
 		fileSystem->removeFile(tmpfile);
 		return true;
 	}
-	// delete possible existing destination file
-	if (fileSystem->fileExists(filename) && !fileSystem->removeFile(filename)) {
+	// Pool index has to know whether the directory changed before the commit.
+	const int64_t dirMtime = PoolIndex::DirMtime(filename);
+	// Existing destination is replaced atomically, so that files read by
+	// other threads or processes never go missing. On Windows this fails
+	// while the destination is open, then it's left untouched.
+	if (!fileSystem->Rename(tmpfile, filename)) {
 		return false;
 	}
-	return fileSystem->Rename(tmpfile, filename);
+	fileSystem->getPoolIndex().RecordCommit(filename, dirMtime);
+	return true;
 }
 
 bool CFile::Open(const std::string& filename)
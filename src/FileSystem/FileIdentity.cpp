@@ -0,0 +1,54 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "FileIdentity.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+std::optional<FileIdentity> getFileIdentity(const std::string& path)
+{
+	HANDLE file = CreateFileW(s2ws(path).c_str(), 0,
+	                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	                          OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return std::nullopt;
+	}
+	BY_HANDLE_FILE_INFORMATION info;
+	const bool ok = GetFileInformationByHandle(file, &info) != 0;
+	CloseHandle(file);
+	if (!ok) {
+		return std::nullopt;
+	}
+	FileIdentity id;
+	id.inode = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	id.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	// FILETIME is in 100ns intervals
+	id.mtime =
+		((int64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime) *
+		100;
+	return id;
+}
+#else
+std::optional<FileIdentity> getFileIdentity(const std::string& path)
+{
+	struct stat sb;
+	if (stat(path.c_str(), &sb) != 0) {
+		return std::nullopt;
+	}
+	FileIdentity id;
+	id.inode = sb.st_ino;
+	id.size = sb.st_size;
+#ifdef __APPLE__
+	id.mtime = int64_t(sb.st_mtimespec.tv_sec) * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+	id.mtime = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+#endif
+	return id;
+}
+#endif
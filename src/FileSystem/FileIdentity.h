@@ -0,0 +1,31 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/**
+ * Identifies a version of file on disk: when the file is replaced or
+ * modified, at least one of the fields changes.
+ */
+struct FileIdentity {
+	uint64_t inode = 0;  // file index on Windows
+	uint64_t size = 0;
+	int64_t mtime = 0;  // in nanoseconds
+
+	bool operator==(const FileIdentity& o) const
+	{
+		return inode == o.inode && size == o.size && mtime == o.mtime;
+	}
+	bool operator!=(const FileIdentity& o) const
+	{
+		return !(*this == o);
+	}
+};
+
+/**
+ * returns identity of the file, nullopt if it doesn't exist
+ */
+std::optional<FileIdentity> getFileIdentity(const std::string& path);
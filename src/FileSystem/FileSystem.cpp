@@ -1,29 +1,42 @@
 /* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
 
 #include "FileSystem.h"
+#include "ContentStore.h"
 #include "Downloader/IDownloader.h"
 #include "FileData.h"
+#include "FileIdentity.h"
+#include "FileTable.h"
 #include "HashGzip.h"
 #include "HashMD5.h"
 #include "IHash.h"
 #include "Logger.h"
+#include "MappedFile.h"
+#include "PoolScan.h"
+#include "PoolValidator.h"
+#include "SdpIndex.h"
 #include "SevenZipArchive.h"
 #include "Tracer.h"
 #include "Util.h"
+#include "ValidationJournal.h"
 #include "ZipArchive.h"
 
-#include <array>
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <filesystem>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
 #include <thread>
+#include <unordered_set>
 #include <zlib.h>
 
 #ifdef _WIN32
@@ -38,6 +51,7 @@
 #endif
 #else
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <unistd.h>
@@ -60,17 +74,24 @@ FILE* CFileSystem::propen(const std::string& filename, const std::string& mode)
 
 bool CFileSystem::hashFile(IHash* outHash, const std::string& path) const
 {
-	char data[IO_BUF_SIZE];
+	// Files are read once from start to end, so we read them in large blocks
+	// directly into a buffer reused by all calls on the thread.
+	constexpr size_t HASH_BUF_SIZE = 256 * 1024;
+	thread_local std::unique_ptr<char[]> data(new char[HASH_BUF_SIZE]);
 	FILE* f = propen(path, "rb");
 	if (f == nullptr) {
 		return false;
 	}
+	setvbuf(f, nullptr, _IONBF, 0);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 	outHash->Init();
 	size_t size;
 	do {
-		size = fread(data, 1, IO_BUF_SIZE, f);
-		outHash->Update(data, size);
-	} while (size == IO_BUF_SIZE);
+		size = fread(data.get(), 1, HASH_BUF_SIZE, f);
+		outHash->Update(data.get(), size);
+	} while (size == HASH_BUF_SIZE);
 	bool ok = !ferror(f);
 	if (!ok) {
 		LOG_ERROR("Failed to read from %s", path.c_str());
@@ -96,69 +117,97 @@ std::string getMD5fromFilename(const std::string& path)
 	return path.substr(start, end - start);
 }
 
-bool CFileSystem::parseSdp(const std::string& filename, std::vector<FileData>& files)
+// Inflates whole gzip file in large blocks.
+static bool readGzFile(const std::string& filename, std::vector<char>& data)
 {
-	TRACE();
-	char c_name[255];
-	unsigned char c_md5[16];
-	unsigned char c_crc32[4];
-	unsigned char c_size[4];
-	unsigned char length;
-
-	FILE* f = propen(filename, "rb");
+	FILE* f = CFileSystem::propen(filename, "rb");
 	if (f == nullptr) {
 		return false;
 	}
 	int fd = fileSystem->dupFileFD(f);
+	fclose(f);
 	if (fd < 0) {
-		fclose(f);
 		return false;
 	}
 	gzFile in = gzdopen(fd, "rb");
 	if (in == Z_NULL) {
 		LOG_ERROR("Could not open %s", filename.c_str());
-		fclose(f);
 		return false;
 	}
-	files.clear();
-	HashMD5 sdpmd5;
-	sdpmd5.Init();
+	gzbuffer(in, 128 * 1024);
+	constexpr size_t blockSize = 256 * 1024;
+	data.clear();
+	size_t used = 0;
 	while (true) {
-
-		if (!gzread(in, &length, 1)) {
-			if (gzeof(in)) {
-				break;
-			}
-			LOG_ERROR("Unexpected eof in %s", filename.c_str());
+		data.resize(used + blockSize);
+		const int read = gzread(in, data.data() + used, blockSize);
+		if (read < 0) {
+			int errnum = Z_OK;
+			LOG_ERROR("Error reading %s: %s", filename.c_str(), gzerror(in, &errnum));
 			gzclose(in);
-			fclose(f);
 			return false;
 		}
-		if (!((gzread(in, &c_name, length)) && (gzread(in, &c_md5, 16)) &&
-		      (gzread(in, &c_crc32, 4)) && (gzread(in, &c_size, 4)))) {
-			LOG_ERROR("Error reading %s", filename.c_str());
-			gzclose(in);
-			fclose(f);
+		used += read;
+		if (read == 0) {
+			break;
+		}
+	}
+	data.resize(used);
+	int errnum = Z_OK;
+	const char* errstr = gzerror(in, &errnum);
+	if (errnum != Z_OK && errnum != Z_STREAM_END) {
+		LOG_ERROR("Error reading %s: %s", filename.c_str(), errstr);
+		gzclose(in);
+		return false;
+	}
+	gzclose(in);
+	return true;
+}
+
+bool CFileSystem::parseSdp(const std::string& filename, FileTable& files)
+{
+	TRACE();
+	// Identity is taken before reading, so that the index is never newer than the sdp.
+	const auto identity = getFileIdentity(filename);
+	if (!identity) {
+		return false;
+	}
+	const std::string indexPath = getSdpIndexPath(filename);
+	if (!indexPath.empty() && loadSdpIndex(indexPath, *identity, files)) {
+		LOG_DEBUG("Loaded %s with %d files from index", filename.c_str(), (int)files.size());
+		return true;
+	}
+
+	std::vector<char> data;
+	if (!readGzFile(filename, data)) {
+		return false;
+	}
+	// Entry: <name length:1><name><md5:16><crc32:4><size:4>
+	files.clear();
+	HashMD5 sdpmd5;
+	sdpmd5.Init();
+	const unsigned char* pos = reinterpret_cast<const unsigned char*>(data.data());
+	const unsigned char* end = pos + data.size();
+	while (pos < end) {
+		const size_t length = *pos;
+		if (size_t(end - pos) < 1 + length + 16 + 4 + 4) {
+			LOG_ERROR("Unexpected eof in %s", filename.c_str());
 			return false;
 		}
-		FileData fd;
-		fd.name = std::string(c_name, length);
-		memcpy(fd.md5, &c_md5, 16);
-		memcpy(fd.crc32, &c_crc32, 4);
-		fd.size = parse_int32(c_size);
-		files.push_back(fd);
+		const std::string_view name(reinterpret_cast<const char*>(pos + 1), length);
+		pos += 1 + length;
+		const unsigned char* md5 = pos;
+		files.add(name, md5, pos + 16, parse_int32(pos + 20));
+		pos += 24;
 
 		HashMD5 nameMd5;
 		nameMd5.Init();
-		nameMd5.Update(fd.name.data(), fd.name.size());
+		nameMd5.Update(name.data(), name.size());
 		nameMd5.Final();
 		assert(nameMd5.getSize() == 16);
-		assert(sizeof(fd.md5) == 16);
 		sdpmd5.Update((const char*)nameMd5.Data(), nameMd5.getSize());
-		sdpmd5.Update((const char*)&fd.md5[0], sizeof(fd.md5));
+		sdpmd5.Update((const char*)md5, FileTable::MD5_SIZE);
 	}
-	gzclose(in);
-	fclose(f);
 	sdpmd5.Final();
 	const std::string filehash = getMD5fromFilename(filename);
 	if (filehash != sdpmd5.toString()) {
@@ -167,6 +216,9 @@ bool CFileSystem::parseSdp(const std::string& filename, std::vector<FileData>& f
 		return false;
 	}
 	LOG_DEBUG("Parsed %s with %d files", filename.c_str(), (int)files.size());
+	if (!indexPath.empty()) {
+		writeSdpIndex(indexPath, *identity, files);
+	}
 	return true;
 }
 
@@ -201,6 +253,7 @@ bool CFileSystem::setWritePath(const std::string& path)
 		}
 	}
 	LOG_INFO("Using filesystem-writepath: %s", springdir.c_str());
+	poolIndex = std::make_unique<PoolIndex>(springdir + PATH_DELIMITER + "pool" + PATH_DELIMITER);
 	return createSubdirs(springdir.c_str());
 }
 
@@ -225,6 +278,12 @@ const std::string CFileSystem::getSpringDir()
 	return springdir;
 }
 
+PoolIndex& CFileSystem::getPoolIndex()
+{
+	getSpringDir();
+	return *poolIndex;
+}
+
 bool CFileSystem::directoryExists(const std::string& path)
 {
 	if (path.empty())
@@ -296,147 +355,47 @@ std::string CFileSystem::getPoolFilename(const std::string& md5str) const
 	       md5str.at(1) + PATH_DELIMITER + md5str.substr(2) + ".gz";
 }
 
-#ifdef _WIN32
 std::optional<std::vector<std::pair<std::string, HashMD5>>> CFileSystem::getPoolFiles()
 {
 	TRACE();
-	std::vector<std::pair<std::string, HashMD5>> files;
 	const std::string basePath = getSpringDir() + PATH_DELIMITER + "pool" + PATH_DELIMITER;
-	const std::wstring baseWPath = s2ws(basePath);
-
-	static constexpr uint32_t MAX_THREADS = 8;
-	const size_t num_threads = std::min(std::thread::hardware_concurrency(), MAX_THREADS);
-
-	std::array<decltype(files), MAX_THREADS> files_parts;
-	std::array<bool, MAX_THREADS> failed;
-	std::array<std::thread, MAX_THREADS> threads;
-
-	for (int tid = 0; tid < num_threads; ++tid) {
-		threads[tid] = std::thread([tid, num_threads, &files = files_parts[tid],
-		                            &failed = failed[tid], &basePath, &baseWPath]() {
-			for (int i = tid; i < 256; i += num_threads) {
-				failed = false;
-				std::string firstByte;
-				{
-					char buf[10];
-					sprintf(buf, "%02x", i);
-					firstByte = buf;
-				}
-
-				wchar_t dir[MAX_PATH];
-				_snwprintf_s(dir, _TRUNCATE, L"%s%02x/*", baseWPath.c_str(), i);
-
-				WIN32_FIND_DATAW fileInfo;
-				HANDLE searchHandle =
-					FindFirstFileExW(dir, FindExInfoBasic, &fileInfo, FindExSearchNameMatch, NULL,
-				                     FIND_FIRST_EX_LARGE_FETCH);
-
-				if (searchHandle == INVALID_HANDLE_VALUE) {
-					if (GetLastError() == ERROR_PATH_NOT_FOUND) {
-						continue;
-					}
-					LOG_ERROR("Failed start file listing: code %d", GetLastError());
-					failed = true;
-					return;
-				}
-
-				do {
-					std::string filename = ws2s(fileInfo.cFileName);
-					constexpr int filenameLen = 33;  // like: 0235f418e51337469e445417853f76.gz
-					if (filename.size() != filenameLen) {
-						continue;
-					}
-					HashMD5 md5;
-					if (!md5.IHash::Set(firstByte + filename.substr(0, filenameLen - 3))) {
-						LOG_WARN("Invalid file name, ignoring: %s/%s", firstByte.c_str(),
-						         filename.c_str());
-						continue;
-					}
-					files.emplace_back(basePath + firstByte + PATH_DELIMITER + filename, md5);
-				} while (FindNextFileW(searchHandle, &fileInfo) != 0);
-
-				if (GetLastError() != ERROR_NO_MORE_FILES) {
-					LOG_ERROR("Failed list files in directory: code %d", GetLastError());
-					failed = true;
-					return;
-				}
-
-				if (FindClose(searchHandle) == 0) {
-					LOG_ERROR("Failed to close search directory: code %d", GetLastError());
-					failed = true;
-					return;
-				}
-			}
-		});
+	std::vector<int> shards(256);
+	std::iota(shards.begin(), shards.end(), 0);
+	const auto listed = scanPoolShards(basePath, shards, /*withSizes=*/false);
+	if (!listed) {
+		return std::nullopt;
 	}
 	size_t total_files_size = 0;
-	for (int tid = 0; tid < num_threads; ++tid) {
-		threads[tid].join();
-		total_files_size += files_parts[tid].size();
-	}
-	files.reserve(total_files_size);
-	for (int tid = 0; tid < num_threads; ++tid) {
-		if (failed[tid]) {
-			return std::nullopt;
-		}
-		files.insert(files.end(), std::make_move_iterator(files_parts[tid].begin()),
-		             std::make_move_iterator(files_parts[tid].end()));
+	for (const auto& entries : *listed) {
+		total_files_size += entries.size();
 	}
-
-	return files;
-}
-#else
-std::optional<std::vector<std::pair<std::string, HashMD5>>> CFileSystem::getPoolFiles()
-try {
-	TRACE();
-	const auto path = u8ToPath(getSpringDir() + PATH_DELIMITER + "pool");
 	std::vector<std::pair<std::string, HashMD5>> files;
-	for (const std::filesystem::directory_entry& dir_entry :
-	     std::filesystem::recursive_directory_iterator(path)) {
-		auto const& p = dir_entry.path();
-		if (!dir_entry.is_regular_file() || p.extension() == ".tmp") {
-			continue;
-		}
-		HashMD5 md5;
-		if (!md5.IHash::Set(p.parent_path().filename().string() + p.stem().string())) {
-			LOG_WARN("Invalid file name, ignoring: %s", pathToU8(p).c_str());
-			continue;
+	files.reserve(total_files_size);
+	for (const auto& entries : *listed) {
+		for (const PoolIndex::Entry& entry : entries) {
+			HashMD5 md5;
+			md5.Set(entry.md5, sizeof(entry.md5));
+			const std::string md5str = md5.toString();
+			files.emplace_back(basePath + md5str.substr(0, 2) + PATH_DELIMITER + md5str.substr(2) +
+			                       ".gz",
+			                   md5);
 		}
-		files.emplace_back(pathToU8(p), md5);
 	}
 	return files;
-} catch (std::filesystem::filesystem_error const& ex) {
-	LOG_ERROR("Failed to read pool files: %s", ex.what());
-	return std::nullopt;
 }
-#endif
 
-bool CFileSystem::validatePool(bool deletebroken)
+bool CFileSystem::validatePool(bool deletebroken, bool full)
 {
 	const auto res = getPoolFiles();
 	if (!res) {
 		return false;
 	}
-	auto const& files_to_validate = *res;
-	bool ok = true;
-	unsigned progress = 0;
-	LOG_PROGRESS(progress, files_to_validate.size());
-	for (const auto& [path, md5] : files_to_validate) {
-		FileData filedata;
-		for (unsigned i = 0; i < 16; i++) {
-			filedata.md5[i] = md5.get(i);
-		}
-		if (!fileIsValid(&filedata, path)) {
-			ok = false;
-			LOG_ERROR("Invalid File in pool: %s", path.c_str());
-			if (deletebroken) {
-				removeFile(path);
-			}
-		}
-		++progress;
-		LOG_PROGRESS(progress, files_to_validate.size(), progress == files_to_validate.size());
+	ValidationJournal journal(getSpringDir() + PATH_DELIMITER + "pool" + PATH_DELIMITER +
+	                          "validation-journal.bin");
+	if (!full) {
+		journal.Load();
 	}
-	return ok;
+	return validatePoolFiles(*res, deletebroken, &journal);
 }
 
 bool CFileSystem::isOlder(const std::string& filename, int secs)
@@ -513,14 +472,16 @@ bool CFileSystem::removeDir(const std::string& path)
 
 bool CFileSystem::dumpSDP(const std::string& filename)
 {
-	std::vector<FileData> files;
+	FileTable files;
 	if (!parseSdp(filename, files))
 		return false;
 	LOG_INFO("md5 (filename in pool)           crc32        size filename");
 	HashMD5 md5;
-	for (const FileData& fd : files) {
-		md5.Set(fd.md5, sizeof(fd.md5));
-		LOG_INFO("%s %.8X %8d %s", md5.toString().c_str(), fd.crc32, fd.size, fd.name.c_str());
+	for (size_t i = 0; i < files.size(); ++i) {
+		md5.Set(files.md5(i), FileTable::MD5_SIZE);
+		const std::string_view name = files.name(i);
+		LOG_INFO("%s %.8X %8d %.*s", md5.toString().c_str(), parse_int32(files.crc32(i)),
+		         files.fileSize(i), (int)name.size(), name.data());
 	}
 	return true;
 }
@@ -533,7 +494,7 @@ bool CFileSystem::validateSDP(const std::string& sdpPath)
 		return false;
 	}
 
-	std::vector<FileData> files;
+	FileTable files;
 	if (!parseSdp(sdpPath, files)) {  // parse downloaded file
 		LOG_ERROR("Removing invalid SDP file: %s", sdpPath.c_str());
 		if (!removeFile(sdpPath)) {
@@ -544,22 +505,22 @@ bool CFileSystem::validateSDP(const std::string& sdpPath)
 	}
 
 	bool valid = true;
-	for (FileData& fd : files) {
+	std::vector<std::pair<std::string, HashMD5>> files_to_validate;
+	for (size_t i = 0; i < files.size(); ++i) {
 		HashMD5 fileMd5;
-		fileMd5.Set(fd.md5, sizeof(fd.md5));
-		const std::string filePath = getPoolFilename(fileMd5.toString());
+		fileMd5.Set(files.md5(i), FileTable::MD5_SIZE);
+		std::string filePath = getPoolFilename(fileMd5.toString());
 		if (!fileExists(filePath)) {
 			valid = false;
 			LOG_INFO("Missing file: %s", filePath.c_str());
-		} else if (!fileIsValid(&fd, filePath)) {
-			valid = false;
-			LOG_INFO("Removing invalid file: %s", filePath.c_str());
-			if (!removeFile(filePath)) {
-				LOG_ERROR("Failed removing %s, aborting", filePath.c_str());
-				return false;
-			}
+		} else {
+			files_to_validate.emplace_back(std::move(filePath), fileMd5);
 		}
 	}
+	// Invalid files are removed.
+	if (!validatePoolFiles(files_to_validate, /*deleteBroken=*/true)) {
+		valid = false;
+	}
 	LOG_DEBUG("CFileSystem::validateSDP() done");
 	return valid;
 }
@@ -569,7 +530,13 @@ bool CFileSystem::extractEngine(const std::string& filename, const std::string&
 {
 	const std::string output = getSpringDir() + PATH_DELIMITER + "engine" + PATH_DELIMITER +
 	                           platform + PATH_DELIMITER + CFileSystem::EscapeFilename(version);
-	if (!extract(filename, output)) {
+	std::unique_ptr<ContentStore> store;
+	const auto store_env = getEnvVar("PRD_ENGINE_STORE");
+	if (store_env && *store_env == "true") {
+		store = std::make_unique<ContentStore>(getSpringDir() + PATH_DELIMITER + "engine-store");
+	}
+	// Reinstalling repairs the engine, only files that differ are written.
+	if (!extract(filename, output, /*overwrite=*/true, store.get())) {
 		LOG_DEBUG("Failed to extract %s %s", filename.c_str(), output.c_str());
 		return false;
 	}
@@ -582,80 +549,259 @@ bool CFileSystem::extractEngine(const std::string& filename, const std::string&
 	return true;
 }
 
-bool CFileSystem::extract(const std::string& filename, const std::string& dstdir, bool overwrite)
+namespace
+{
+
+// Directories created during extraction, so that path prefixes don't need to
+// be checked again for every extracted file. Thread safe.
+class DirectoryCache
+{
+public:
+	bool create(const std::string& dir)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (dirs.count(dir) > 0) {
+			return true;
+		}
+		if (!CFileSystem::createSubdirs(dir)) {
+			return false;
+		}
+		dirs.insert(dir);
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::unordered_set<std::string> dirs;
+};
+
+// Reads using the archive itself, for archives that don't support readers.
+class ArchiveReader : public IArchive::Reader
+{
+public:
+	explicit ArchiveReader(IArchive& archive_)
+		: archive(archive_)
+	{
+	}
+
+	bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) override
+	{
+		return archive.GetFile(fid, buffer);
+	}
+
+private:
+	IArchive& archive;
+};
+
+}  // namespace
+
+static bool extractFile(const IArchive& archive, IArchive::Reader& reader, unsigned int fid,
+                        const std::string& filename, const std::string& dstdir, bool overwrite,
+                        const ContentStore* store, DirectoryCache& dirs)
+{
+	std::string name;
+	int size, mode;
+	archive.FileInfo(fid, name, size, mode);
+#ifdef _WIN32
+	for (unsigned int i = 0; i < name.length(); i++) {  // replace / with \ on win32
+		if (name[i] == '/')
+			name[i] = PATH_DELIMITER;
+	}
+#endif
+	std::string tmp = dstdir;
+
+	if (!tmp.empty() && tmp[tmp.length() - 1] != PATH_DELIMITER) {
+		tmp += PATH_DELIMITER;
+	}
+
+	tmp += name.c_str();  // FIXME: concating UTF-16
+	dirs.create(CFileSystem::DirName(tmp));
+	// 7z archives don't store CRC of empty files.
+	const auto crc = size == 0 ? std::optional<uint32_t>(0) : archive.GetCrc32(fid);
+	if (fileSystem->fileExists(tmp)) {
+		if (!overwrite) {
+			LOG_WARN("File already exists: %s", tmp.c_str());
+			return true;
+		}
+		if (crc && CFileSystem::fileMatchesCrc32(tmp, static_cast<unsigned int>(size), *crc)) {
+			LOG_DEBUG("File is up to date: %s", tmp.c_str());
+			return true;
+		}
+		// The file can be a link to a stored file, so it's replaced instead
+		// of being written in place.
+		CFileSystem::removeFile(tmp);
+	}
+	const bool useStore = store != nullptr && crc.has_value();
+	HashMD5 md5;
+	const auto hashData = [&](const unsigned char* data, size_t size) {
+		for (size_t pos = 0; pos < size;) {
+			const int len = std::min<size_t>(size - pos, 1 << 30);
+			md5.Update(reinterpret_cast<const char*>(data + pos), len);
+			pos += len;
+		}
+	};
+	if (useStore && store->Contains(size, *crc, mode)) {
+		// Size and CRC32 can collide, stored file is used only if md5 of
+		// the entry matches too. Decompressing is still cheaper than writing.
+		md5.Init();
+		const bool ok = reader.ReadFile(fid, [&](const unsigned char* data, size_t size) {
+			hashData(data, size);
+			return true;
+		});
+		if (!ok) {
+			LOG_ERROR("Error extracting %s from %s", name.c_str(), filename.c_str());
+			return false;
+		}
+		md5.Final();
+		if (store->Link(size, *crc, mode, md5.toString(), tmp)) {
+			LOG_DEBUG("Linked from store (%s)", tmp.c_str());
+			return true;
+		}
+	}
+	LOG_INFO("extracting (%s)", tmp.c_str());
+	FILE* f = CFileSystem::propen(tmp, "wb+");
+	if (f == nullptr) {
+		LOG_ERROR("Error creating %s", tmp.c_str());
+		return false;
+	}
+	bool write_failed = false;
+	md5.Init();
+	const bool ok = reader.ReadFile(fid, [&](const unsigned char* data, size_t size) {
+		write_failed = size > 0 && fwrite(data, size, 1, f) != 1;
+		if (useStore) {
+			hashData(data, size);
+		}
+		return !write_failed;
+	});
+	if (write_failed) {
+		const int err = ferror(f);
+		LOG_ERROR("fwrite(%s): %d %s", name.c_str(), err, strerror(err));
+	} else if (!ok) {
+		LOG_ERROR("Error extracting %s from %s", name.c_str(), filename.c_str());
+	}
+#ifndef _WIN32
+	fchmod(fileno(f), mode);
+#endif
+	fclose(f);
+	if (!ok) {
+		CFileSystem::removeFile(tmp);
+	} else if (useStore) {
+		md5.Final();
+		store->Add(size, *crc, mode, md5.toString(), tmp);
+	}
+	return ok;
+}
+
+bool CFileSystem::extract(const std::string& filename, const std::string& dstdir, bool overwrite,
+                          const ContentStore* store)
 {
+	TRACE();
 	LOG_INFO("Extracting %s to %s", filename.c_str(), dstdir.c_str());
 	const int len = filename.length();
-	IArchive* archive;
+	std::unique_ptr<IArchive> archive;
 	if ((len > 4) && (filename.compare(len - 3, 3, ".7z") == 0)) {
-		archive = new CSevenZipArchive(filename);
+		archive = std::make_unique<CSevenZipArchive>(filename);
 	} else {
-		archive = new CZipArchive(filename);
+		archive = std::make_unique<CZipArchive>(filename);
 	}
 
 	const unsigned int num = archive->NumFiles();
 	if (num <= 0) {
 		LOG_WARN("Empty archive:  %s", filename.c_str());
-		delete archive;
 		return false;
 	}
-	std::vector<unsigned char> buf;
-	for (unsigned int i = 0; i < num; i++) {
-		buf.clear();
+
+	// Files of a block are decompressed together, so they are extracted by
+	// the same reader in archive order. Largest blocks go first, so that
+	// threads finish at similar times.
+	std::vector<unsigned int> order(num);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		return archive->GetBlock(a) < archive->GetBlock(b);
+	});
+	struct Block {
+		size_t begin, end;
+		uint64_t size;
+	};
+	std::vector<Block> blocks;
+	for (size_t i = 0; i < num; ++i) {
+		if (i == 0 || archive->GetBlock(order[i]) != archive->GetBlock(order[i - 1])) {
+			blocks.push_back({i, i, 0});
+		}
 		std::string name;
 		int size, mode;
-		archive->FileInfo(i, name, size, mode);
-		if (!archive->GetFile(i, buf)) {
-			LOG_ERROR("Error extracting %s from %s", name.c_str(), filename.c_str());
-			delete archive;
-			return false;
-		}
-#ifdef _WIN32
-		for (unsigned int i = 0; i < name.length(); i++) {  // replace / with \ on win32
-			if (name[i] == '/')
-				name[i] = PATH_DELIMITER;
-		}
-#endif
-		std::string tmp = dstdir;
-
-		if (!tmp.empty() && tmp[tmp.length() - 1] != PATH_DELIMITER) {
-			tmp += PATH_DELIMITER;
+		archive->FileInfo(order[i], name, size, mode);
+		blocks.back().end = i + 1;
+		blocks.back().size += size;
+	}
+	std::stable_sort(blocks.begin(), blocks.end(),
+	                 [](const Block& a, const Block& b) { return a.size > b.size; });
+
+	// Decompressing is CPU bound, each thread reads the archive using its
+	// own reader. Readers can hold a decompressed block in memory, so
+	// their number is limited for archives with large blocks.
+	static constexpr unsigned MAX_THREADS = 16;
+	static constexpr uint64_t MAX_READERS_MEMORY = 1024 * 1024 * 1024;
+	const uint64_t readerMemory = std::max<uint64_t>(archive->ReaderMemoryUsage(), 1);
+	const unsigned numThreads = std::clamp<uint64_t>(
+		std::min<uint64_t>({std::thread::hardware_concurrency(), blocks.size(),
+	                        MAX_READERS_MEMORY / readerMemory}),
+		1, MAX_THREADS);
+	std::vector<std::unique_ptr<IArchive::Reader>> readers;
+	for (unsigned i = 0; i < numThreads; ++i) {
+		auto reader = archive->OpenReader();
+		if (reader == nullptr) {
+			break;
 		}
+		readers.emplace_back(std::move(reader));
+	}
+	if (readers.empty()) {
+		readers.emplace_back(std::make_unique<ArchiveReader>(*archive));
+	}
 
-		tmp += name.c_str();  // FIXME: concating UTF-16
-		createSubdirs(DirName(tmp));
-		if (fileSystem->fileExists(tmp)) {
-			LOG_WARN("File already exists: %s", tmp.c_str());
-			if (!overwrite)
-				continue;
-		}
-		LOG_INFO("extracting (%s)", tmp.c_str());
-		FILE* f = propen(tmp, "wb+");
-		if (f == nullptr) {
-			LOG_ERROR("Error creating %s", tmp.c_str());
-			delete archive;
-			return false;
-		}
-		int res = 1;
-		if (!buf.empty())
-			res = fwrite(&buf[0], buf.size(), 1, f);
-#ifndef _WIN32
-		fchmod(fileno(f), mode);
-#endif
-		if (res <= 0) {
-			const int err = ferror(f);
-			LOG_ERROR("fwrite(%s): %d %s", name.c_str(), err, strerror(err));
-			fclose(f);
-			delete archive;
-			return false;
+	DirectoryCache dirs;
+	std::atomic<size_t> next = 0;
+	std::atomic<bool> failed = false;
+	const auto worker = [&](IArchive::Reader& reader) {
+		for (size_t b = next++; b < blocks.size() && !failed; b = next++) {
+			for (size_t i = blocks[b].begin; i < blocks[b].end && !failed; ++i) {
+				if (!extractFile(*archive, reader, order[i], filename, dstdir, overwrite, store,
+				                 dirs)) {
+					failed = true;
+				}
+			}
 		}
-		fclose(f);
+	};
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < readers.size(); ++i) {
+		threads.emplace_back(worker, std::ref(*readers[i]));
+	}
+	worker(*readers[0]);
+	for (auto& t : threads) {
+		t.join();
+	}
+	if (failed) {
+		return false;
 	}
-	delete archive;
 	LOG_INFO("done");
 	return true;
 }
 
+bool CFileSystem::fileMatchesCrc32(const std::string& path, uint64_t size, uint32_t crc)
+{
+	MappedFile file;
+	if (!file.Open(path) || file.size() != size) {
+		return false;
+	}
+	uLong fileCrc = crc32(0L, Z_NULL, 0);
+	for (size_t pos = 0; pos < file.size();) {
+		const uInt len = std::min<size_t>(file.size() - pos, 1 << 30);
+		fileCrc = crc32(fileCrc, reinterpret_cast<const Bytef*>(file.data() + pos), len);
+		pos += len;
+	}
+	return fileCrc == crc;
+}
+
 bool CFileSystem::Rename(const std::string& source, const std::string& destination)
 try {
 	std::filesystem::rename(u8ToPath(source), u8ToPath(destination));
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <filesystem>
 #include <list>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -12,10 +13,13 @@
 #include "FileData.h"
 #include "HashMD5.h"
 #include "IHash.h"
+#include "PoolIndex.h"
 
 class SRepository;
 class CRepo;
 class IDownload;
+class FileTable;
+class ContentStore;
 
 #ifdef _WIN32
 struct _FILETIME;
@@ -55,7 +59,7 @@ public:
 	/**
 	 * parses the file for a mod and creates
 	 */
-	bool parseSdp(const std::string& filename, std::vector<FileData>& files);
+	bool parseSdp(const std::string& filename, FileTable& files);
 
 	bool hashFile(IHash* outHash, const std::string& path) const;
 
@@ -86,10 +90,16 @@ public:
 	std::optional<std::vector<std::pair<std::string, HashMD5>>> getPoolFiles();
 
 	/**
-	 * Validate all files in /pool/ (check md5)
+	 * returns the persistent index of files in pool
+	 */
+	PoolIndex& getPoolIndex();
+
+	/**
+	 * Validate all files in /pool/ (check md5). Unless full is set, only files
+	 * added or changed since the previous validation are checked.
 	 * @return Whatever all files were correct or not
 	 */
-	bool validatePool(bool deletebroken);
+	bool validatePool(bool deletebroken, bool full = false);
 
 	/**
 	 * check if file is older then secs, returns true if file is older or something goes wrong
@@ -99,6 +109,10 @@ public:
 	 * check if a file is readable
 	 */
 	static bool fileExists(const std::string& filename);
+	/**
+	 * checks whether the file has the given size and CRC32, it's read only when the size matches
+	 */
+	static bool fileMatchesCrc32(const std::string& path, uint64_t size, uint32_t crc);
 	/**
 	 *
 	 *	parses the bencoded torrent data, strucutre is like this:
@@ -122,9 +136,13 @@ public:
 	 */
 	bool validateSDP(const std::string& filename);
 	/**
-	 * extracts a 7z file to dstdir
+	 * extracts a 7z or zip file to dstdir. Existing files are kept, unless
+	 * overwrite is set. Then only files whose size or CRC differs from the
+	 * archive are written. With store, extracted files are hardlinked from
+	 * and added to it.
 	 */
-	bool extract(const std::string& filename, const std::string& dstdir, bool overwrite = false);
+	bool extract(const std::string& filename, const std::string& dstdir, bool overwrite = false,
+	             const ContentStore* store = nullptr);
 	/**
 	 * extract engine download
 	 */
@@ -179,6 +197,7 @@ private:
 	std::list<FileData> mods;
 	bool parse_repository_line(char* str, SRepository* repository, int size);
 	std::string springdir;
+	std::unique_ptr<PoolIndex> poolIndex;
 };
 
 #define fileSystem CFileSystem::GetInstance()
@@ -0,0 +1,85 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "FileTable.h"
+
+#include <bit>
+#include <cstring>
+
+void FileTable::clear()
+{
+	md5s.clear();
+	crc32s.clear();
+	sizes.clear();
+	nameEnds.clear();
+	downloadBits.clear();
+	names.clear();
+}
+
+void FileTable::reserve(size_t count, size_t namesSize)
+{
+	md5s.reserve(count * MD5_SIZE);
+	crc32s.reserve(count * CRC32_SIZE);
+	sizes.reserve(count);
+	nameEnds.reserve(count);
+	downloadBits.reserve((count + 63) / 64);
+	names.reserve(namesSize);
+}
+
+void FileTable::add(std::string_view name, const unsigned char* md5, const unsigned char* crc32,
+                    uint32_t size)
+{
+	md5s.insert(md5s.end(), md5, md5 + MD5_SIZE);
+	crc32s.insert(crc32s.end(), crc32, crc32 + CRC32_SIZE);
+	names.append(name);
+	nameEnds.push_back(names.size());
+	sizes.push_back(size);
+	if (sizes.size() > downloadBits.size() * 64) {
+		downloadBits.push_back(0);
+	}
+}
+
+size_t FileTable::nextDownload(size_t from) const
+{
+	if (from >= size()) {
+		return NPOS;
+	}
+	size_t word = from / 64;
+	// Bits past the last file are never set.
+	uint64_t bits = downloadBits[word] & (~uint64_t(0) << (from % 64));
+	while (bits == 0) {
+		if (++word == downloadBits.size()) {
+			return NPOS;
+		}
+		bits = downloadBits[word];
+	}
+	return word * 64 + std::countr_zero(bits);
+}
+
+bool FileTable::assign(size_t count, const void* md5Data, const void* crc32Data,
+                       const void* sizeData, const void* nameEndData, std::string_view namesData)
+{
+	clear();
+	nameEnds.resize(count);
+	memcpy(nameEnds.data(), nameEndData, count * sizeof(uint32_t));
+	uint32_t prev = 0;
+	for (const uint32_t end : nameEnds) {
+		if (end < prev) {
+			nameEnds.clear();
+			return false;
+		}
+		prev = end;
+	}
+	if (prev != namesData.size()) {
+		nameEnds.clear();
+		return false;
+	}
+	md5s.resize(count * MD5_SIZE);
+	memcpy(md5s.data(), md5Data, md5s.size());
+	crc32s.resize(count * CRC32_SIZE);
+	memcpy(crc32s.data(), crc32Data, crc32s.size());
+	sizes.resize(count);
+	memcpy(sizes.data(), sizeData, count * sizeof(uint32_t));
+	names.assign(namesData);
+	downloadBits.assign((count + 63) / 64, 0);
+	return true;
+}
@@ -0,0 +1,133 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * List of files of an sdp package.
+ *
+ * Packages can have hundreds of thousands of files, so instead of an object
+ * per file every field is kept in its own contiguous array: md5 and crc32
+ * digests, sizes, download flags as a bitset and all names in a single
+ * buffer. Loops over a single field, like checking which files are missing
+ * from the pool, touch only the memory they need, and loading the table
+ * from the sdp index is a few copies of whole arrays.
+ */
+class FileTable
+{
+public:
+	static constexpr size_t MD5_SIZE = 16;
+	static constexpr size_t CRC32_SIZE = 4;
+	static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+	size_t size() const
+	{
+		return sizes.size();
+	}
+
+	bool empty() const
+	{
+		return sizes.empty();
+	}
+
+	void clear();
+
+	void reserve(size_t count, size_t namesSize);
+
+	/**
+	 * appends a file, md5 and crc32 are 16 and 4 bytes long, it's not marked for download
+	 */
+	void add(std::string_view name, const unsigned char* md5, const unsigned char* crc32,
+	         uint32_t size);
+
+	std::string_view name(size_t i) const
+	{
+		const uint32_t start = i == 0 ? 0 : nameEnds[i - 1];
+		return std::string_view(names).substr(start, nameEnds[i] - start);
+	}
+
+	const unsigned char* md5(size_t i) const
+	{
+		return md5s.data() + i * MD5_SIZE;
+	}
+
+	const unsigned char* crc32(size_t i) const
+	{
+		return crc32s.data() + i * CRC32_SIZE;
+	}
+
+	uint32_t fileSize(size_t i) const
+	{
+		return sizes[i];
+	}
+
+	bool download(size_t i) const
+	{
+		return (downloadBits[i / 64] >> (i % 64)) & 1;
+	}
+
+	void setDownload(size_t i, bool download)
+	{
+		const uint64_t bit = uint64_t(1) << (i % 64);
+		if (download) {
+			downloadBits[i / 64] |= bit;
+		} else {
+			downloadBits[i / 64] &= ~bit;
+		}
+	}
+
+	/**
+	 * returns index of the first file marked for download at or after from, NPOS if there is none
+	 */
+	size_t nextDownload(size_t from) const;
+
+	bool hasDownloads(size_t from = 0) const
+	{
+		return nextDownload(from) != NPOS;
+	}
+
+	/**
+	 * Raw arrays, used to store the table in the sdp index. Name of file i ends at nameEnds[i]
+	 * and starts where the name of the previous file ends.
+	 */
+	const unsigned char* md5Data() const
+	{
+		return md5s.data();
+	}
+	const unsigned char* crc32Data() const
+	{
+		return crc32s.data();
+	}
+	const uint32_t* sizeData() const
+	{
+		return sizes.data();
+	}
+	const uint32_t* nameEndData() const
+	{
+		return nameEnds.data();
+	}
+	std::string_view namesData() const
+	{
+		return names;
+	}
+
+	/**
+	 * replaces content of the table with copies of raw arrays of count files, which don't need
+	 * to be aligned. Fails and leaves the table empty if name ends don't match the names.
+	 */
+	bool assign(size_t count, const void* md5Data, const void* crc32Data, const void* sizeData,
+	            const void* nameEndData, std::string_view namesData);
+
+private:
+	std::vector<unsigned char> md5s;
+	std::vector<unsigned char> crc32s;
+	std::vector<uint32_t> sizes;
+	std::vector<uint32_t> nameEnds;
+	std::vector<uint64_t> downloadBits;
+	std::string names;
+};
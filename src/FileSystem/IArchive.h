@@ -2,7 +2,11 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -23,6 +27,35 @@ protected:
 	}
 
 public:
+	/**
+	 * Reads files of the archive using its own handle of the archive file.
+	 */
+	class Reader
+	{
+	public:
+		/**
+		 * Receives contents of a file, possibly in multiple chunks.
+		 * Returning false aborts reading.
+		 */
+		using Sink = std::function<bool(const unsigned char* data, size_t size)>;
+
+		virtual ~Reader() = default;
+		/**
+		 * Same as IArchive::GetFile
+		 */
+		virtual bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) = 0;
+		/**
+		 * Passes contents of a file to sink, by default all at once after
+		 * reading it with GetFile.
+		 * @return true if the file was read and sink accepted all of it
+		 */
+		virtual bool ReadFile(unsigned int fid, const Sink& sink)
+		{
+			std::vector<unsigned char> buffer;
+			return GetFile(fid, buffer) && sink(buffer.data(), buffer.size());
+		}
+	};
+
 	virtual ~IArchive() = default;
 
 	// virtual bool IsOpen() = 0;
@@ -74,6 +107,31 @@ public:
 	 * @see GetFile(unsigned int fid, std::vector<boost::uint8_t>& buffer)
 	 */
 	bool GetFile(const std::string& name, std::vector<unsigned char>& buffer);
+	/**
+	 * Opens a reader independent of the archive and other readers, so that
+	 * files can be read from multiple threads at the same time.
+	 * @return nullptr if the archive doesn't support it
+	 */
+	virtual std::unique_ptr<Reader> OpenReader() const
+	{
+		return nullptr;
+	}
+	/**
+	 * Files of the same block can be decompressed only together, like files
+	 * of a solid block in 7z archives. They should be read by the same
+	 * reader in order of their ids.
+	 */
+	virtual unsigned int GetBlock(unsigned int fid) const
+	{
+		return fid;
+	}
+	/**
+	 * Returns how much memory a reader can use for decompressed data.
+	 */
+	virtual uint64_t ReaderMemoryUsage() const
+	{
+		return 0;
+	}
 	/**
 	 * Fetches the name and size in bytes of a file by its ID.
 	 */
@@ -91,9 +149,12 @@ public:
 	 */
 	// virtual bool HasLowReadingCost(unsigned int fid) const;
 	/**
-	 * Fetches the CRC32 hash of a file by its ID.
+	 * Fetches the CRC32 hash of a file by its ID, if the archive stores it.
 	 */
-	// virtual unsigned int GetCrc32(unsigned int fid);
+	virtual std::optional<uint32_t> GetCrc32(unsigned int /*fid*/) const
+	{
+		return std::nullopt;
+	}
 
 protected:
 	// must be populated by the subclass
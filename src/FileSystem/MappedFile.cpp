@@ -0,0 +1,107 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "MappedFile.h"
+
+#include "Logger.h"
+#include "Util.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string& filename)
+{
+	Close();
+	HANDLE file = CreateFileW(s2ws(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+	                          NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) == 0) {
+		LOG_ERROR("Failed to get size of %s: code %d", filename.c_str(), GetLastError());
+		CloseHandle(file);
+		return false;
+	}
+	if (fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return true;
+	}
+	HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		LOG_ERROR("Failed to map %s: code %d", filename.c_str(), GetLastError());
+		return false;
+	}
+	// The view keeps the mapping alive.
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == NULL) {
+		LOG_ERROR("Failed to map %s: code %d", filename.c_str(), GetLastError());
+		return false;
+	}
+	ptr = static_cast<const char*>(view);
+	length = fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (ptr != nullptr) {
+		UnmapViewOfFile(ptr);
+	}
+	ptr = nullptr;
+	length = 0;
+}
+#else
+bool MappedFile::Open(const std::string& filename)
+{
+	Close();
+	const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		LOG_ERROR("Failed to stat %s: %s", filename.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+	if (sb.st_size == 0) {
+		close(fd);
+		return true;
+	}
+	void* addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		LOG_ERROR("Failed to map %s: %s", filename.c_str(), strerror(errno));
+		return false;
+	}
+	ptr = static_cast<const char*>(addr);
+	length = sb.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (ptr != nullptr) {
+		munmap(const_cast<char*>(ptr), length);
+	}
+	ptr = nullptr;
+	length = 0;
+}
+#endif
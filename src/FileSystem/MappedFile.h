@@ -0,0 +1,37 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Read only memory mapping of a whole file.
+ */
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	/**
+	 * maps the file into memory, returns false if file couldn't be opened or mapped
+	 */
+	bool Open(const std::string& filename);
+	void Close();
+
+	const char* data() const
+	{
+		return ptr;
+	}
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	const char* ptr = nullptr;
+	size_t length = 0;
+};
@@ -0,0 +1,87 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "Md5Set.h"
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+static constexpr size_t MIN_SLOTS = 16;
+
+Md5Set::Md5Set(size_t expected_size)
+{
+	reserve(expected_size);
+}
+
+Md5Set::Key Md5Set::toKey(const unsigned char* md5)
+{
+	Key key;
+	memcpy(key.data(), md5, sizeof(key));
+	return key;
+}
+
+// Returns slot with the key or empty slot where it belongs.
+size_t Md5Set::findSlot(const Key& key) const
+{
+	assert(!slots.empty());
+	const size_t mask = slots.size() - 1;
+	for (size_t i = key[0] & mask;; i = (i + 1) & mask) {
+		if (slots[i] == key || (slots[i][0] == 0 && slots[i][1] == 0)) {
+			return i;
+		}
+	}
+}
+
+void Md5Set::reserve(size_t expected_size)
+{
+	// Keep load factor at most 1/2.
+	size_t new_size = MIN_SLOTS;
+	while (new_size < expected_size * 2) {
+		new_size *= 2;
+	}
+	if (new_size <= slots.size()) {
+		return;
+	}
+	std::vector<Key> old_slots(new_size, Key{0, 0});
+	std::swap(slots, old_slots);
+	for (const Key& key : old_slots) {
+		if (key[0] != 0 || key[1] != 0) {
+			slots[findSlot(key)] = key;
+		}
+	}
+}
+
+bool Md5Set::insert(const unsigned char* md5)
+{
+	const Key key = toKey(md5);
+	if (key[0] == 0 && key[1] == 0) {
+		if (has_zero) {
+			return false;
+		}
+		has_zero = true;
+		++count;
+		return true;
+	}
+	if ((count + 1) * 2 > slots.size()) {
+		reserve(count + 1);
+	}
+	Key& slot = slots[findSlot(key)];
+	if (slot == key) {
+		return false;
+	}
+	slot = key;
+	++count;
+	return true;
+}
+
+bool Md5Set::contains(const unsigned char* md5) const
+{
+	const Key key = toKey(md5);
+	if (key[0] == 0 && key[1] == 0) {
+		return has_zero;
+	}
+	if (slots.empty()) {
+		return false;
+	}
+	return slots[findSlot(key)] == key;
+}
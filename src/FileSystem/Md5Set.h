@@ -0,0 +1,48 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Set of binary md5 digests.
+ *
+ * Open addressing hash table with linear probing. md5 is uniformly
+ * distributed, so part of the digest itself is used as the hash.
+ */
+class Md5Set
+{
+public:
+	explicit Md5Set(size_t expected_size = 0);
+
+	/**
+	 * inserts 16 bytes long md5, returns false if it was already present
+	 */
+	bool insert(const unsigned char* md5);
+
+	/**
+	 * checks if the 16 bytes long md5 is in the set
+	 */
+	bool contains(const unsigned char* md5) const;
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	void reserve(size_t expected_size);
+
+private:
+	// All zeros digest marks an empty slot, so it's tracked separately.
+	using Key = std::array<uint64_t, 2>;
+
+	static Key toKey(const unsigned char* md5);
+	size_t findSlot(const Key& key) const;
+
+	std::vector<Key> slots;
+	size_t count = 0;
+	bool has_zero = false;
+};
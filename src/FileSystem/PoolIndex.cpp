@@ -0,0 +1,300 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "PoolIndex.h"
+
+#include "FileSystem.h"
+#include "Logger.h"
+#include "MappedFile.h"
+#include "PoolScan.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string_view>
+#include <system_error>
+
+namespace
+{
+
+constexpr int NUM_SHARDS = 256;
+// Records of logs written with previous version are skipped, because their
+// directories are not known to be listed.
+constexpr uint64_t INDEX_MAGIC = 0x3258444950445250;  // "PRDPIDX2" in little endian
+// Directory needs to be listed again.
+constexpr int64_t MTIME_UNKNOWN = std::numeric_limits<int64_t>::min();
+// Directory doesn't exist.
+constexpr int64_t MTIME_MISSING = std::numeric_limits<int64_t>::min() + 1;
+
+// Both files are stored in native byte order, index written on machine with
+// different endianness will simply fail the magic check and get rebuilt.
+struct IndexHeader {
+	uint64_t magic;
+	uint64_t count;
+	int64_t mtimes[NUM_SHARDS];
+};
+
+struct LogRecord {
+	unsigned char md5[16];
+	uint64_t size;
+	int64_t mtimeBefore;  // of the pool directory before the file was added to it
+	int64_t mtime;        // of the pool directory after the file was added to it
+};
+
+static_assert(sizeof(PoolIndex::Entry) == 24);
+static_assert(sizeof(LogRecord) == 40);
+
+std::string shardName(int shard)
+{
+	char buf[3];
+	snprintf(buf, sizeof(buf), "%02x", shard);
+	return std::string(buf, 2);
+}
+
+int64_t getDirMtime(const std::filesystem::path& dir)
+{
+	std::error_code ec;
+	const auto mtime = std::filesystem::last_write_time(dir, ec);
+	if (ec) {
+		return ec == std::errc::no_such_file_or_directory ? MTIME_MISSING : MTIME_UNKNOWN;
+	}
+	return mtime.time_since_epoch().count();
+}
+
+// Files added to the directory right after it was listed might not change its
+// modification time due to timestamp granularity, so we don't trust recent ones.
+bool isRecentMtime(int64_t mtime)
+{
+	using namespace std::chrono_literals;
+	const auto now = std::filesystem::file_time_type::clock::now().time_since_epoch();
+	return now - std::filesystem::file_time_type::duration(mtime) < 2s;
+}
+
+bool readIndex(const MappedFile& index, std::vector<std::vector<PoolIndex::Entry>>& shards,
+               std::vector<int64_t>& mtimes)
+{
+	IndexHeader header;
+	if (index.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, index.data(), sizeof(header));
+	const size_t maxCount = (index.size() - sizeof(header)) / sizeof(PoolIndex::Entry);
+	if (header.magic != INDEX_MAGIC || header.count != maxCount ||
+	    index.size() != sizeof(header) + maxCount * sizeof(PoolIndex::Entry)) {
+		return false;
+	}
+	const char* data = index.data() + sizeof(header);
+	for (size_t i = 0; i < header.count; ++i) {
+		PoolIndex::Entry entry;
+		memcpy(&entry, data + i * sizeof(entry), sizeof(entry));
+		shards[entry.md5[0]].push_back(entry);
+	}
+	mtimes.assign(std::begin(header.mtimes), std::end(header.mtimes));
+	return true;
+}
+
+bool md5Less(const PoolIndex::Entry& a, const PoolIndex::Entry& b)
+{
+	return memcmp(a.md5, b.md5, sizeof(a.md5)) < 0;
+}
+
+bool md5Equal(const PoolIndex::Entry& a, const PoolIndex::Entry& b)
+{
+	return memcmp(a.md5, b.md5, sizeof(a.md5)) == 0;
+}
+
+}  // namespace
+
+PoolIndex::PoolIndex(std::string poolDir_)
+	: poolDir(std::move(poolDir_))
+	, indexPath(poolDir + "pool-index.bin")
+	, logPath(poolDir + "pool-index.log")
+{
+}
+
+PoolIndex::~PoolIndex()
+{
+	if (log != nullptr) {
+		fclose(log);
+	}
+}
+
+std::optional<std::vector<PoolIndex::Entry>> PoolIndex::Load()
+{
+	TRACE();
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::vector<Entry>> shards(NUM_SHARDS);
+	std::vector<int64_t> mtimes(NUM_SHARDS, MTIME_UNKNOWN);
+	std::vector<bool> unsorted(NUM_SHARDS, false);
+	bool modified = false;
+
+	{
+		MappedFile index;
+		if (index.Open(indexPath) && !readIndex(index, shards, mtimes)) {
+			LOG_WARN("Pool index %s is not valid, rebuilding it", indexPath.c_str());
+			shards.assign(NUM_SHARDS, {});
+			mtimes.assign(NUM_SHARDS, MTIME_UNKNOWN);
+		}
+	}
+
+	bool hasLog = false;
+	{
+		MappedFile logFile;
+		hasLog = logFile.Open(logPath) && logFile.size() > 0;
+		const size_t count = logFile.size() / sizeof(LogRecord);
+		for (size_t i = 0; i < count; ++i) {
+			LogRecord record;
+			memcpy(&record, logFile.data() + i * sizeof(record), sizeof(record));
+			const int shard = record.md5[0];
+			modified = true;
+			// Without complete listing of the directory the log is useless.
+			if (mtimes[shard] == MTIME_UNKNOWN) {
+				continue;
+			}
+			// Directory changed between the listing and the commit by
+			// something that wasn't logged, e.g. a file was removed.
+			if (record.mtimeBefore != mtimes[shard]) {
+				mtimes[shard] = MTIME_UNKNOWN;
+				continue;
+			}
+			Entry entry;
+			memcpy(entry.md5, record.md5, sizeof(entry.md5));
+			entry.size = record.size;
+			shards[shard].push_back(entry);
+			mtimes[shard] = isRecentMtime(record.mtime) ? MTIME_UNKNOWN : record.mtime;
+			unsorted[shard] = true;
+		}
+	}
+
+	// mtime must be taken before listing, so that concurrent changes
+	// invalidate the listing.
+	std::vector<int> stale;
+	std::vector<int64_t> staleMtimes;
+	for (int i = 0; i < NUM_SHARDS; ++i) {
+		const int64_t mtime = getDirMtime(u8ToPath(poolDir + shardName(i)));
+		if (mtime == MTIME_UNKNOWN || mtime != mtimes[i]) {
+			stale.push_back(i);
+			staleMtimes.push_back(mtime);
+		}
+	}
+	LOG_DEBUG("Pool index: listing %zu of %d pool directories", stale.size(), NUM_SHARDS);
+	auto listed = scanPoolShards(poolDir, stale, /*withSizes=*/true);
+	if (!listed) {
+		return std::nullopt;
+	}
+	for (size_t i = 0; i < stale.size(); ++i) {
+		const int shard = stale[i];
+		modified = true;
+		shards[shard] = std::move((*listed)[i]);
+		unsorted[shard] = true;
+		mtimes[shard] = isRecentMtime(staleMtimes[i]) ? MTIME_UNKNOWN : staleMtimes[i];
+	}
+
+	size_t total = 0;
+	for (int i = 0; i < NUM_SHARDS; ++i) {
+		auto& entries = shards[i];
+		if (unsorted[i]) {
+			std::sort(entries.begin(), entries.end(), md5Less);
+			entries.erase(std::unique(entries.begin(), entries.end(), md5Equal), entries.end());
+		}
+		total += entries.size();
+	}
+
+	if (modified && writeIndex(shards, mtimes) && hasLog) {
+		// Records appended by other processes since we read the log are lost
+		// here, that is fine: their directories will just be listed again.
+		if (log != nullptr) {
+			fclose(log);
+			log = nullptr;
+		}
+		if (FILE* f = CFileSystem::propen(logPath, "wb"); f != nullptr) {
+			fclose(f);
+		}
+	}
+
+	std::vector<Entry> entries;
+	entries.reserve(total);
+	for (const auto& shard : shards) {
+		entries.insert(entries.end(), shard.begin(), shard.end());
+	}
+	return entries;
+}
+
+bool PoolIndex::writeIndex(const std::vector<std::vector<Entry>>& shards,
+                           const std::vector<int64_t>& mtimes)
+{
+	IndexHeader header = {};
+	header.magic = INDEX_MAGIC;
+	for (int i = 0; i < NUM_SHARDS; ++i) {
+		header.count += shards[i].size();
+		header.mtimes[i] = mtimes[i];
+	}
+
+	const std::string tmpPath = indexPath + ".tmp";
+	FILE* f = CFileSystem::propen(tmpPath, "wb");
+	if (f == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (const auto& entries : shards) {
+		if (ok && !entries.empty()) {
+			ok = fwrite(entries.data(), sizeof(Entry), entries.size(), f) == entries.size();
+		}
+	}
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		LOG_WARN("Failed to write pool index %s: %s", tmpPath.c_str(), strerror(errno));
+		CFileSystem::removeFile(tmpPath);
+		return false;
+	}
+	return fileSystem->Rename(tmpPath, indexPath);
+}
+
+int64_t PoolIndex::DirMtime(const std::string& path)
+{
+	return getDirMtime(u8ToPath(path).parent_path());
+}
+
+void PoolIndex::RecordCommit(const std::string& path, int64_t dirMtimeBefore)
+{
+	// <poolDir><2 hex chars>/<30 hex chars>.gz
+	constexpr size_t poolPathLen = 2 + 1 + 33;
+	if (path.size() != poolDir.size() + poolPathLen ||
+	    path.compare(0, poolDir.size(), poolDir) != 0) {
+		return;
+	}
+	const char* dir = path.c_str() + poolDir.size();
+	if (!isxdigit(dir[0]) || !isxdigit(dir[1]) || dir[2] != PATH_DELIMITER) {
+		return;
+	}
+	LogRecord record;
+	const unsigned char shard = std::stoi(std::string(dir, 2), nullptr, 16);
+	if (!parsePoolFilename(shard, std::string_view(dir + 3), record.md5)) {
+		return;
+	}
+	const auto p = u8ToPath(path);
+	std::error_code ec;
+	record.size = std::filesystem::file_size(p, ec);
+	if (ec) {
+		return;
+	}
+	record.mtimeBefore = dirMtimeBefore;
+	record.mtime = getDirMtime(p.parent_path());
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (log == nullptr) {
+		log = CFileSystem::propen(logPath, "ab");
+		if (log == nullptr) {
+			return;
+		}
+	}
+	if (fwrite(&record, sizeof(record), 1, log) != 1 || fflush(log) != 0) {
+		LOG_WARN("Failed to write pool index log %s: %s", logPath.c_str(), strerror(errno));
+	}
+}
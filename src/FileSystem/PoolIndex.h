@@ -0,0 +1,67 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Persistent index of files in the rapid pool.
+ *
+ * pool/pool-index.bin holds md5 and size of all pool files, sorted by md5,
+ * together with modification times of the 256 pool directories from the
+ * moment they were listed. Files committed to the pool are appended to
+ * pool/pool-index.log with modification times of their directory from before
+ * and after the commit.
+ *
+ * When loading, a log record is applied only if its directory didn't change
+ * since it was listed or since the previous record. Then only directories
+ * whose modification time doesn't match the recorded one are listed again,
+ * so changes made by other programs are still picked up. Afterwards the index
+ * is rewritten and the log is cleared.
+ */
+class PoolIndex
+{
+public:
+	struct Entry {
+		unsigned char md5[16];
+		uint64_t size;
+	};
+
+	/**
+	 * poolDir is the pool directory, with path delimiter at the end
+	 */
+	explicit PoolIndex(std::string poolDir);
+	~PoolIndex();
+
+	/**
+	 * returns all files in the pool, sorted by md5
+	 */
+	std::optional<std::vector<Entry>> Load();
+
+	/**
+	 * returns modification time of the directory containing path, to be taken
+	 * before the file is written there and passed to RecordCommit
+	 */
+	static int64_t DirMtime(const std::string& path);
+
+	/**
+	 * records a file that was just written to the pool, paths outside of the
+	 * pool are ignored. Thread safe.
+	 */
+	void RecordCommit(const std::string& path, int64_t dirMtimeBefore);
+
+private:
+	bool writeIndex(const std::vector<std::vector<Entry>>& shards,
+	                const std::vector<int64_t>& mtimes);
+
+	const std::string poolDir;
+	const std::string indexPath;
+	const std::string logPath;
+	std::mutex mutex;
+	FILE* log = nullptr;
+};
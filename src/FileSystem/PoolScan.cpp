@@ -0,0 +1,246 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "PoolScan.h"
+
+#include "FileSystem.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+static int hexValue(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool parsePoolFilename(unsigned char shard, std::string_view filename, unsigned char md5[16])
+{
+	constexpr size_t filenameLen = 33;  // like: 0235f418e51337469e445417853f76.gz
+	if (filename.size() != filenameLen || filename.substr(filenameLen - 3) != ".gz") {
+		return false;
+	}
+	md5[0] = shard;
+	for (int i = 0; i < 15; ++i) {
+		const int h = hexValue(filename[i * 2]);
+		const int l = hexValue(filename[i * 2 + 1]);
+		if (h < 0 || l < 0) {
+			LOG_WARN("Invalid file name, ignoring: %02x/%.*s", shard, (int)filename.size(),
+			         filename.data());
+			return false;
+		}
+		md5[i + 1] = h * 16 + l;
+	}
+	return true;
+}
+
+static std::string shardName(int shard)
+{
+	char buf[3];
+	snprintf(buf, sizeof(buf), "%02x", shard);
+	return std::string(buf, 2);
+}
+
+#ifdef _WIN32
+static bool scanShard(const std::string& poolDir, int shard, bool /*withSizes*/,
+                      std::vector<PoolIndex::Entry>& entries)
+{
+	const std::wstring dir = s2ws(poolDir + shardName(shard) + PATH_DELIMITER + "*");
+	WIN32_FIND_DATAW fileInfo;
+	HANDLE searchHandle = FindFirstFileExW(dir.c_str(), FindExInfoBasic, &fileInfo,
+	                                       FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (searchHandle == INVALID_HANDLE_VALUE) {
+		if (GetLastError() == ERROR_PATH_NOT_FOUND) {
+			return true;
+		}
+		LOG_ERROR("Failed start file listing: code %d", GetLastError());
+		return false;
+	}
+
+	do {
+		PoolIndex::Entry entry;
+		if ((fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 ||
+		    !parsePoolFilename(shard, ws2s(fileInfo.cFileName), entry.md5)) {
+			continue;
+		}
+		// Sizes come with the listing for free.
+		entry.size = (uint64_t(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow;
+		entries.push_back(entry);
+	} while (FindNextFileW(searchHandle, &fileInfo) != 0);
+
+	if (GetLastError() != ERROR_NO_MORE_FILES) {
+		LOG_ERROR("Failed list files in directory: code %d", GetLastError());
+		FindClose(searchHandle);
+		return false;
+	}
+
+	if (FindClose(searchHandle) == 0) {
+		LOG_ERROR("Failed to close search directory: code %d", GetLastError());
+		return false;
+	}
+	return true;
+}
+#elif defined(__linux__)
+// Layout of records returned by getdents64 syscall.
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// Uses getdents64 directly with large buffer and d_type, so that regular
+// files can be recognized without stat call per file.
+static bool scanShard(int poolFd, int shard, bool withSizes, std::vector<PoolIndex::Entry>& entries)
+{
+	const std::string name = shardName(shard);
+	const int fd = openat(poolFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return true;
+		}
+		LOG_ERROR("Failed to open pool directory %s: %s", name.c_str(), strerror(errno));
+		return false;
+	}
+	alignas(linux_dirent64) char buf[64 * 1024];
+	for (;;) {
+		const long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+		if (n < 0) {
+			LOG_ERROR("Failed to list pool directory %s: %s", name.c_str(), strerror(errno));
+			close(fd);
+			return false;
+		}
+		if (n == 0) {
+			break;
+		}
+		for (long pos = 0; pos < n;) {
+			const auto* d = reinterpret_cast<const linux_dirent64*>(buf + pos);
+			pos += d->d_reclen;
+			PoolIndex::Entry entry;
+			if ((d->d_type != DT_REG && d->d_type != DT_UNKNOWN) ||
+			    !parsePoolFilename(shard, d->d_name, entry.md5)) {
+				continue;
+			}
+			entry.size = 0;
+			if (withSizes || d->d_type == DT_UNKNOWN) {
+				struct stat sb;
+				if (fstatat(fd, d->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+					// Removed in the meantime.
+					continue;
+				}
+				if (!S_ISREG(sb.st_mode)) {
+					continue;
+				}
+				entry.size = sb.st_size;
+			}
+			entries.push_back(entry);
+		}
+	}
+	close(fd);
+	return true;
+}
+#else
+static bool scanShard(const std::string& poolDir, int shard, bool withSizes,
+                      std::vector<PoolIndex::Entry>& entries)
+try {
+	const auto dir = u8ToPath(poolDir + shardName(shard));
+	std::error_code ec;
+	if (!std::filesystem::exists(dir, ec)) {
+		return true;
+	}
+	for (const std::filesystem::directory_entry& dir_entry :
+	     std::filesystem::directory_iterator(dir)) {
+		PoolIndex::Entry entry;
+		if (!parsePoolFilename(shard, pathToU8(dir_entry.path().filename()), entry.md5) ||
+		    !dir_entry.is_regular_file()) {
+			continue;
+		}
+		entry.size = withSizes ? dir_entry.file_size() : 0;
+		entries.push_back(entry);
+	}
+	return true;
+} catch (std::filesystem::filesystem_error const& ex) {
+	LOG_ERROR("Failed to read pool files: %s", ex.what());
+	return false;
+}
+#endif
+
+std::optional<std::vector<std::vector<PoolIndex::Entry>>>
+scanPoolShards(const std::string& poolDir, const std::vector<int>& shards, bool withSizes)
+{
+	TRACE();
+	std::vector<std::vector<PoolIndex::Entry>> result(shards.size());
+	if (shards.empty()) {
+		return result;
+	}
+
+#if defined(__linux__)
+	// All shards are opened relative to the pool directory.
+	const int poolFd = open(poolDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (poolFd < 0) {
+		if (errno == ENOENT) {
+			return result;
+		}
+		LOG_ERROR("Failed to open pool directory %s: %s", poolDir.c_str(), strerror(errno));
+		return std::nullopt;
+	}
+	const auto& dir = poolFd;
+#else
+	const auto& dir = poolDir;
+#endif
+
+	static constexpr unsigned MAX_THREADS = 8;
+	const unsigned numThreads =
+		std::clamp(std::min<unsigned>(std::thread::hardware_concurrency(), shards.size()), 1u,
+	               MAX_THREADS);
+	std::atomic<size_t> next = 0;
+	std::atomic<bool> failed = false;
+	const auto worker = [&]() {
+		for (size_t i = next++; i < shards.size() && !failed; i = next++) {
+			if (!scanShard(dir, shards[i], withSizes, result[i])) {
+				failed = true;
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < numThreads; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : threads) {
+		t.join();
+	}
+
+#if defined(__linux__)
+	close(poolFd);
+#endif
+	if (failed) {
+		return std::nullopt;
+	}
+	return result;
+}
@@ -0,0 +1,26 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "PoolIndex.h"
+
+/**
+ * Parses name of a file in pool directory shard (first byte of md5), like
+ * 0235f418e51337469e445417853f76.gz, into md5. Returns false for other files.
+ */
+bool parsePoolFilename(unsigned char shard, std::string_view filename, unsigned char md5[16]);
+
+/**
+ * Lists pool files in the given pool subdirectories (0-255) in parallel.
+ *
+ * poolDir is the pool directory with path delimiter at the end. Returns list of
+ * files for each of the requested shards, in the same order. Sizes are filled
+ * only if requested, on Linux it's the only case which needs a stat call.
+ */
+std::optional<std::vector<std::vector<PoolIndex::Entry>>>
+scanPoolShards(const std::string& poolDir, const std::vector<int>& shards, bool withSizes);
@@ -0,0 +1,98 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "PoolValidator.h"
+
+#include "Downloader/IDownloader.h"
+#include "FileData.h"
+#include "FileSystem.h"
+#include "Logger.h"
+#include "Tracer.h"
+#include "ValidationJournal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+static void reportProgress(size_t done, size_t total)
+{
+	if (IDownloader::listener != nullptr) {
+		IDownloader::listener(done, total);
+	}
+	LOG_PROGRESS(done, total, done == total);
+}
+
+bool validatePoolFiles(const std::vector<std::pair<std::string, HashMD5>>& files,
+                       bool deleteBroken, ValidationJournal* journal)
+{
+	TRACE();
+	const size_t total = files.size();
+	// Inflating is CPU bound, so we use all cores.
+	const unsigned numThreads =
+		std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(total, 1));
+
+	std::atomic<size_t> next = 0;
+	std::atomic<size_t> done = 0;
+	std::atomic<size_t> skipped = 0;
+	std::atomic<bool> valid = true;
+	std::atomic<bool> aborted = false;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	const auto worker = [&]() {
+		for (size_t i = next++; i < total; i = next++) {
+			const auto& [path, md5] = files[i];
+			// Identity must be taken before hashing, so that changes made
+			// during validation are not attributed to the validated contents.
+			const auto identity = journal != nullptr && !aborted ? getFileIdentity(path)
+			                                                     : std::optional<FileIdentity>();
+			FileData filedata;
+			memcpy(filedata.md5, md5.Data(), sizeof(filedata.md5));
+			if (aborted) {
+				// Remaining files are only counted, so that waiting for them ends.
+			} else if (identity && journal->Check(filedata.md5, *identity)) {
+				++skipped;
+			} else if (fileSystem->fileIsValid(&filedata, path)) {
+				if (identity) {
+					journal->Add(filedata.md5, *identity);
+				}
+			} else {
+				valid = false;
+				LOG_ERROR("Invalid File in pool: %s", path.c_str());
+				if (deleteBroken && !CFileSystem::removeFile(path)) {
+					LOG_ERROR("Failed removing %s, aborting", path.c_str());
+					aborted = true;
+				}
+			}
+			if (++done == total) {
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_one();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < numThreads; ++i) {
+		threads.emplace_back(worker);
+	}
+	{
+		using namespace std::chrono_literals;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!finished.wait_for(lock, 100ms, [&] { return done == total; })) {
+			reportProgress(done, total);
+		}
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	reportProgress(total, total);
+	if (journal != nullptr) {
+		LOG_INFO("Validated %zu files, skipped %zu files unchanged since previous validation",
+		         total - skipped, size_t(skipped));
+		journal->Save();
+	}
+	return valid;
+}
@@ -0,0 +1,25 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "HashMD5.h"
+
+class ValidationJournal;
+
+/**
+ * Validates (path, md5) pool files on all available cores, files are checked
+ * in the given order. Broken files are removed right away if deleteBroken is
+ * set, validation is aborted if that fails. Progress is reported via
+ * LOG_PROGRESS and the download listener.
+ *
+ * With journal, files that didn't change since they were validated last time
+ * are skipped, and the journal is updated with the correct files.
+ *
+ * @return Whatever all files were correct or not
+ */
+bool validatePoolFiles(const std::vector<std::pair<std::string, HashMD5>>& files,
+                       bool deleteBroken, ValidationJournal* journal = nullptr);
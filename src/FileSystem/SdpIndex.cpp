@@ -0,0 +1,118 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "SdpIndex.h"
+
+#include "FileSystem.h"
+#include "FileTable.h"
+#include "Logger.h"
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+namespace
+{
+
+constexpr uint64_t SDP_INDEX_MAGIC = 0x3249504453445250;  // "PRDSDPI2" in little endian
+
+// Stored in native byte order, like pool index. The header is followed by
+// arrays of FileTable: md5s, crc32s, sizes and name ends, and then the names.
+struct IndexHeader {
+	uint64_t magic;
+	FileIdentity identity;
+	uint64_t count;
+	uint64_t names_size;
+};
+
+constexpr size_t ENTRY_SIZE =
+	FileTable::MD5_SIZE + FileTable::CRC32_SIZE + sizeof(uint32_t) + sizeof(uint32_t);
+
+static_assert(sizeof(IndexHeader) == 48);
+
+}  // namespace
+
+std::string getSdpIndexPath(const std::string& sdpPath)
+{
+	// Only sdp files of the packages directory are indexed, others can be
+	// anywhere and we don't want to leave files next to them.
+	const std::string dir =
+		fileSystem->getSpringDir() + PATH_DELIMITER + "packages" + PATH_DELIMITER;
+	constexpr std::string_view ext = ".sdp";
+	if (sdpPath.size() < dir.size() + ext.size() || sdpPath.compare(0, dir.size(), dir) != 0 ||
+	    sdpPath.compare(sdpPath.size() - ext.size(), ext.size(), ext) != 0) {
+		return "";
+	}
+	return sdpPath + "idx";
+}
+
+bool loadSdpIndex(const std::string& indexPath, const FileIdentity& sdpIdentity,
+                  FileTable& files)
+{
+	MappedFile index;
+	if (!index.Open(indexPath)) {
+		return false;
+	}
+	IndexHeader header;
+	if (index.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, index.data(), sizeof(header));
+	if (header.magic != SDP_INDEX_MAGIC || header.identity != sdpIdentity) {
+		return false;
+	}
+	const size_t maxCount = (index.size() - sizeof(header)) / ENTRY_SIZE;
+	if (header.count > maxCount ||
+	    header.names_size != index.size() - sizeof(header) - header.count * ENTRY_SIZE) {
+		LOG_WARN("Ignoring broken sdp index %s", indexPath.c_str());
+		return false;
+	}
+	const char* md5s = index.data() + sizeof(header);
+	const char* crc32s = md5s + header.count * FileTable::MD5_SIZE;
+	const char* sizes = crc32s + header.count * FileTable::CRC32_SIZE;
+	const char* nameEnds = sizes + header.count * sizeof(uint32_t);
+	const char* names = nameEnds + header.count * sizeof(uint32_t);
+	if (!files.assign(header.count, md5s, crc32s, sizes, nameEnds,
+	                  std::string_view(names, header.names_size))) {
+		LOG_WARN("Ignoring broken sdp index %s", indexPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool writeSdpIndex(const std::string& indexPath, const FileIdentity& sdpIdentity,
+                   const FileTable& files)
+{
+	IndexHeader header = {};
+	header.magic = SDP_INDEX_MAGIC;
+	header.identity = sdpIdentity;
+	header.count = files.size();
+	header.names_size = files.namesData().size();
+	const size_t count = files.size();
+
+	const std::string tmpPath = indexPath + ".tmp";
+	FILE* f = CFileSystem::propen(tmpPath, "wb");
+	if (f == nullptr) {
+		return false;
+	}
+	const auto write = [f](const void* data, size_t size) {
+		return size == 0 || fwrite(data, size, 1, f) == 1;
+	};
+	bool ok = write(&header, sizeof(header)) &&
+	          write(files.md5Data(), count * FileTable::MD5_SIZE) &&
+	          write(files.crc32Data(), count * FileTable::CRC32_SIZE) &&
+	          write(files.sizeData(), count * sizeof(uint32_t)) &&
+	          write(files.nameEndData(), count * sizeof(uint32_t)) &&
+	          write(files.namesData().data(), header.names_size);
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		LOG_WARN("Failed to write sdp index %s: %s", tmpPath.c_str(), strerror(errno));
+		CFileSystem::removeFile(tmpPath);
+		return false;
+	}
+	return fileSystem->Rename(tmpPath, indexPath);
+}
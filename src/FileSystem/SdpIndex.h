@@ -0,0 +1,33 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <string>
+
+#include "FileIdentity.h"
+
+class FileTable;
+
+/**
+ * Binary index of a parsed sdp file, stored next to it as <md5>.sdpidx.
+ *
+ * The index holds the already validated file list together with identity
+ * of the sdp file it was created from, so loading it doesn't need to inflate
+ * the sdp and hash the file names again.
+ */
+
+/**
+ * returns path of the index for sdp file in the packages directory, empty
+ * for other files
+ */
+std::string getSdpIndexPath(const std::string& sdpPath);
+
+/**
+ * loads files from the index, fails if it's missing, broken or was created
+ * from a different version of the sdp file
+ */
+bool loadSdpIndex(const std::string& indexPath, const FileIdentity& sdpIdentity,
+                  FileTable& files);
+
+bool writeSdpIndex(const std::string& indexPath, const FileIdentity& sdpIdentity,
+                   const FileTable& files);
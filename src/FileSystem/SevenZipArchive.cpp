@@ -107,13 +107,13 @@ static inline const char* GetErrorStr(int err)
 	return "Unknown error";
 }
 
-CSevenZipArchive::CSevenZipArchive(const std::string& name)
-	: IArchive(name)
-	, allocImp({SzAlloc, SzFree})
-	, allocTempImp({SzAllocTemp, SzFreeTemp})
+// Opens the archive file for reading through lookStream.
+static bool OpenInStream(const std::string& name, CFileInStream& archiveStream,
+                         CLookToRead2& lookStream, ISzAlloc& allocImp)
 {
 	constexpr const size_t kInputBufSize = (size_t)1 << 18;
 
+	lookStream.buf = nullptr;
 #ifdef _WIN32
 	WRes wres = InFile_OpenW(&archiveStream.file, s2ws(name).c_str());
 #else
@@ -121,7 +121,7 @@ CSevenZipArchive::CSevenZipArchive(const std::string& name)
 #endif
 	if (wres != 0) {
 		LOG_ERROR("Error opening %s %s", name.c_str(), strerror(wres));
-		return;
+		return false;
 	}
 
 	FileInStream_CreateVTable(&archiveStream);
@@ -133,10 +133,21 @@ CSevenZipArchive::CSevenZipArchive(const std::string& name)
 	assert(lookStream.buf != NULL);
 	lookStream.bufSize = kInputBufSize;
 	LookToRead2_Init(&lookStream);
+	return true;
+}
 
-	CrcGenerateTable();
-
+CSevenZipArchive::CSevenZipArchive(const std::string& name)
+	: IArchive(name)
+	, archiveName(name)
+	, allocImp({SzAlloc, SzFree})
+	, allocTempImp({SzAllocTemp, SzFreeTemp})
+{
 	SzArEx_Init(&db);
+	if (!OpenInStream(name, archiveStream, lookStream, allocImp)) {
+		return;
+	}
+
+	CrcGenerateTable();
 
 	const SRes res = SzArEx_Open(&db, &lookStream.vt, &allocImp, &allocTempImp);
 	if (res == SZ_OK) {
@@ -219,3 +230,107 @@ void CSevenZipArchive::FileInfo(unsigned int fid, std::string& name, int& size,
 	size = fileData[fid].size;
 	mode = fileData[fid].mode;
 }
+
+// Shares the parsed archive database, which isn't modified by extraction,
+// but has its own file handle and decompressed block.
+class CSevenZipArchive::SevenZipReader : public IArchive::Reader
+{
+public:
+	explicit SevenZipReader(const CSevenZipArchive& archive_)
+		: archive(archive_)
+		, allocImp({SzAlloc, SzFree})
+		, allocTempImp({SzAllocTemp, SzFreeTemp})
+	{
+		isOpen = OpenInStream(archive.archiveName, archiveStream, lookStream, allocImp);
+	}
+
+	~SevenZipReader()
+	{
+		if (outBuffer != nullptr) {
+			IAlloc_Free(&allocImp, outBuffer);
+		}
+		if (isOpen) {
+			File_Close(&archiveStream.file);
+		}
+		ISzAlloc_Free(&allocImp, lookStream.buf);
+	}
+
+	bool IsOpen() const
+	{
+		return isOpen;
+	}
+
+	bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) override
+	{
+		return ReadFile(fid, [&buffer](const unsigned char* data, size_t size) {
+			buffer.assign(data, data + size);
+			return true;
+		});
+	}
+
+	// The whole block is decompressed into outBuffer once, when its first
+	// file is read, and files are passed to sink directly from it.
+	bool ReadFile(unsigned int fid, const Sink& sink) override
+	{
+		const FileData& fd = archive.fileData[fid];
+		size_t offset;
+		size_t outSizeProcessed;
+		const SRes res =
+			SzArEx_Extract(&archive.db, &lookStream.vt, fd.fp, &blockIndex, &outBuffer,
+		                   &outBufferSize, &offset, &outSizeProcessed, &allocImp, &allocTempImp);
+		if (res != SZ_OK) {
+			LOG_ERROR("Error extracting %s: %s", fd.origName.c_str(), GetErrorStr(res));
+			return false;
+		}
+		return sink(outBuffer + offset, outSizeProcessed);
+	}
+
+private:
+	const CSevenZipArchive& archive;
+	UInt32 blockIndex = 0xFFFFFFFF;
+	Byte* outBuffer = nullptr;
+	size_t outBufferSize = 0;
+
+	CFileInStream archiveStream;
+	CLookToRead2 lookStream;
+	ISzAlloc allocImp;
+	ISzAlloc allocTempImp;
+
+	bool isOpen = false;
+};
+
+std::unique_ptr<IArchive::Reader> CSevenZipArchive::OpenReader() const
+{
+	if (!isOpen) {
+		return nullptr;
+	}
+	auto reader = std::make_unique<SevenZipReader>(*this);
+	if (!reader->IsOpen()) {
+		return nullptr;
+	}
+	return reader;
+}
+
+unsigned int CSevenZipArchive::GetBlock(unsigned int fid) const
+{
+	// Empty files don't belong to any block, they are all put in the last one.
+	return db.FileToFolder[fileData[fid].fp];
+}
+
+std::optional<uint32_t> CSevenZipArchive::GetCrc32(unsigned int fid) const
+{
+	const int fp = fileData[fid].fp;
+	if (!SzBitWithVals_Check(&db.CRCs, fp)) {
+		return std::nullopt;
+	}
+	return db.CRCs.Vals[fp];
+}
+
+uint64_t CSevenZipArchive::ReaderMemoryUsage() const
+{
+	uint64_t largest = 0;
+	for (UInt32 i = 0; i < db.db.NumFolders; ++i) {
+		largest = std::max<uint64_t>(largest, SzAr_GetFolderUnpackSize(&db.db, i));
+	}
+	return largest;
+}
@@ -21,8 +21,14 @@ public:
 	virtual unsigned int NumFiles() const override;
 	virtual bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) override;
 	virtual void FileInfo(unsigned int fid, std::string& name, int& size, int& mode) const override;
+	std::unique_ptr<Reader> OpenReader() const override;
+	unsigned int GetBlock(unsigned int fid) const override;
+	std::optional<uint32_t> GetCrc32(unsigned int fid) const override;
+	uint64_t ReaderMemoryUsage() const override;
 
 private:
+	class SevenZipReader;
+
 	struct FileData {
 		int fp;
 		/**
@@ -39,6 +45,7 @@ private:
 
 	std::vector<FileData> fileData;
 
+	const std::string archiveName;
 	UInt32 blockIndex = 0xFFFFFFFF;
 	Byte* outBuffer = nullptr;
 	size_t outBufferSize = 0;
@@ -0,0 +1,113 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#include "ValidationJournal.h"
+
+#include "FileSystem.h"
+#include "Logger.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+
+constexpr uint64_t JOURNAL_MAGIC = 0x314c4e4a4c415652;  // "RVALJNL1" in little endian
+
+struct JournalHeader {
+	uint64_t magic;
+	uint64_t count;
+};
+
+static_assert(sizeof(ValidationJournal::Record) == 48);
+
+bool md5Less(const ValidationJournal::Record& a, const ValidationJournal::Record& b)
+{
+	return memcmp(a.md5, b.md5, sizeof(a.md5)) < 0;
+}
+
+}  // namespace
+
+ValidationJournal::ValidationJournal(std::string path_)
+	: path(std::move(path_))
+{
+}
+
+void ValidationJournal::Load()
+{
+	previous.clear();
+	MappedFile journal;
+	if (!journal.Open(path)) {
+		return;
+	}
+	JournalHeader header;
+	if (journal.size() < sizeof(header)) {
+		return;
+	}
+	memcpy(&header, journal.data(), sizeof(header));
+	const size_t count = (journal.size() - sizeof(header)) / sizeof(Record);
+	if (header.magic != JOURNAL_MAGIC || header.count != count ||
+	    journal.size() != sizeof(header) + count * sizeof(Record)) {
+		LOG_WARN("Ignoring invalid validation journal %s", path.c_str());
+		return;
+	}
+	previous.resize(count);
+	memcpy(previous.data(), journal.data() + sizeof(header), count * sizeof(Record));
+	if (!std::is_sorted(previous.begin(), previous.end(), md5Less)) {
+		LOG_WARN("Ignoring invalid validation journal %s", path.c_str());
+		previous.clear();
+	}
+}
+
+bool ValidationJournal::Check(const unsigned char* md5, const FileIdentity& identity)
+{
+	Record key;
+	memcpy(key.md5, md5, sizeof(key.md5));
+	const auto it = std::lower_bound(previous.begin(), previous.end(), key, md5Less);
+	if (it == previous.end() || memcmp(it->md5, md5, sizeof(it->md5)) != 0 ||
+	    it->identity != identity) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	current.push_back(*it);
+	return true;
+}
+
+void ValidationJournal::Add(const unsigned char* md5, const FileIdentity& identity)
+{
+	Record record;
+	memcpy(record.md5, md5, sizeof(record.md5));
+	record.identity = identity;
+	record.validated_at = time(nullptr);
+	std::lock_guard<std::mutex> lock(mutex);
+	current.push_back(record);
+}
+
+bool ValidationJournal::Save()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::sort(current.begin(), current.end(), md5Less);
+	JournalHeader header = {JOURNAL_MAGIC, current.size()};
+
+	const std::string tmpPath = path + ".tmp";
+	FILE* f = CFileSystem::propen(tmpPath, "wb");
+	if (f == nullptr) {
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (ok && !current.empty()) {
+		ok = fwrite(current.data(), sizeof(Record), current.size(), f) == current.size();
+	}
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		LOG_ERROR("Failed to write validation journal %s: %s", tmpPath.c_str(), strerror(errno));
+		CFileSystem::removeFile(tmpPath);
+		return false;
+	}
+	return fileSystem->Rename(tmpPath, path);
+}
@@ -0,0 +1,57 @@
+/* This file is part of pr-downloader (GPL v2 or later), see the LICENSE file */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "FileIdentity.h"
+
+/**
+ * Journal of validated pool files.
+ *
+ * Pool files are never modified after they are written, so file that was
+ * validated before and still has the same identity (inode, size, mtime)
+ * doesn't need to be hashed again.
+ */
+class ValidationJournal
+{
+public:
+	struct Record {
+		unsigned char md5[16];
+		FileIdentity identity;
+		int64_t validated_at;  // unix timestamp
+	};
+
+	explicit ValidationJournal(std::string path);
+
+	/**
+	 * loads records of previous validation, missing or broken journal is
+	 * treated as empty
+	 */
+	void Load();
+
+	/**
+	 * returns true if the file was validated before and didn't change since,
+	 * the record is then kept in the new journal. Thread safe.
+	 */
+	bool Check(const unsigned char* md5, const FileIdentity& identity);
+
+	/**
+	 * records a file that was just validated. Thread safe.
+	 */
+	void Add(const unsigned char* md5, const FileIdentity& identity);
+
+	/**
+	 * replaces the journal with records passed to Check and Add
+	 */
+	bool Save();
+
+private:
+	const std::string path;
+	std::vector<Record> previous;  // sorted by md5
+	std::vector<Record> current;
+	std::mutex mutex;
+};
@@ -7,8 +7,9 @@
 
 #include "Logger.h"
 
-CZipArchive::CZipArchive(const std::string& archiveName)
-	: IArchive(archiveName)
+CZipArchive::CZipArchive(const std::string& archiveName_)
+	: IArchive(archiveName_)
+	, archiveName(archiveName_)
 {
 	zip = unzOpen(archiveName.c_str());
 	if (!zip) {
@@ -72,7 +73,7 @@ void CZipArchive::FileInfo(unsigned int fid, std::string& name, int& size, int&
 	mode = fileData[fid].mode;
 }
 
-unsigned int CZipArchive::GetCrc32(unsigned int fid)
+std::optional<uint32_t> CZipArchive::GetCrc32(unsigned int fid) const
 {
 	//	assert(IsFileId(fid));
 
@@ -82,15 +83,10 @@ unsigned int CZipArchive::GetCrc32(unsigned int fid)
 // To simplify things, files are always read completely into memory from
 // the zip-file, since zlib does not provide any way of reading more
 // than one file at a time
-bool CZipArchive::GetFile(unsigned int fid, std::vector<unsigned char>& buffer)
+static bool readFile(unzFile zip, const unz_file_pos& fp, std::vector<unsigned char>& buffer)
 {
-	// Prevent opening files on missing/invalid archives
-	if (!zip) {
-		return false;
-	}
-	//	assert(IsFileId(fid));
-
-	unzGoToFilePos(zip, &fileData[fid].fp);
+	unz_file_pos pos = fp;
+	unzGoToFilePos(zip, &pos);
 
 	unz_file_info fi;
 	unzGetCurrentFileInfo(zip, &fi, nullptr, 0, nullptr, 0, nullptr, 0);
@@ -117,3 +113,100 @@ bool CZipArchive::GetFile(unsigned int fid, std::vector<unsigned char>& buffer)
 
 	return ret;
 }
+
+// Decompresses the file in chunks of the size of chunk buffer and passes
+// them to sink, so memory use doesn't depend on the size of the file.
+// minizip computes the CRC while reading and checks it on close.
+static bool streamFile(unzFile zip, const unz_file_pos& fp, std::vector<unsigned char>& chunk,
+                       const IArchive::Reader::Sink& sink)
+{
+	unz_file_pos pos = fp;
+	unzGoToFilePos(zip, &pos);
+
+	unz_file_info fi;
+	unzGetCurrentFileInfo(zip, &fi, nullptr, 0, nullptr, 0, nullptr, 0);
+
+	if (unzOpenCurrentFile(zip) != UNZ_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	uLong total = 0;
+	while (true) {
+		const int read = unzReadCurrentFile(zip, chunk.data(), chunk.size());
+		if (read <= 0) {
+			ret = read == 0;
+			break;
+		}
+		total += read;
+		if (!sink(chunk.data(), read)) {
+			ret = false;
+			break;
+		}
+	}
+
+	// The CRC is checked only when the whole file was read.
+	if (unzCloseCurrentFile(zip) == UNZ_CRCERROR || total != fi.uncompressed_size) {
+		ret = false;
+	}
+
+	return ret;
+}
+
+bool CZipArchive::GetFile(unsigned int fid, std::vector<unsigned char>& buffer)
+{
+	// Prevent opening files on missing/invalid archives
+	if (!zip) {
+		return false;
+	}
+	//	assert(IsFileId(fid));
+
+	return readFile(zip, fileData[fid].fp, buffer);
+}
+
+// Entries are located by their stored positions, so the reader doesn't need
+// to go through the central directory again.
+class CZipArchive::ZipReader : public IArchive::Reader
+{
+public:
+	ZipReader(const CZipArchive& archive_, unzFile zip_)
+		: archive(archive_)
+		, zip(zip_)
+	{
+	}
+
+	~ZipReader()
+	{
+		unzClose(zip);
+	}
+
+	bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) override
+	{
+		return readFile(zip, archive.fileData[fid].fp, buffer);
+	}
+
+	bool ReadFile(unsigned int fid, const Sink& sink) override
+	{
+		return streamFile(zip, archive.fileData[fid].fp, chunk, sink);
+	}
+
+private:
+	static constexpr size_t CHUNK_SIZE = 256 * 1024;
+
+	const CZipArchive& archive;
+	unzFile zip;
+	std::vector<unsigned char> chunk = std::vector<unsigned char>(CHUNK_SIZE);
+};
+
+std::unique_ptr<IArchive::Reader> CZipArchive::OpenReader() const
+{
+	if (!zip) {
+		return nullptr;
+	}
+	unzFile readerZip = unzOpen(archiveName.c_str());
+	if (!readerZip) {
+		LOG_ERROR("Error opening %s", archiveName.c_str());
+		return nullptr;
+	}
+	return std::make_unique<ZipReader>(*this, readerZip);
+}
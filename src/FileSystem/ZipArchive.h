@@ -21,10 +21,14 @@ public:
 
 	virtual unsigned int NumFiles() const override;
 	virtual void FileInfo(unsigned int fid, std::string& name, int& size, int& mode) const override;
-	virtual unsigned int GetCrc32(unsigned int fid);
+	std::optional<uint32_t> GetCrc32(unsigned int fid) const override;
 	bool GetFile(unsigned int fid, std::vector<unsigned char>& buffer) override;
+	std::unique_ptr<Reader> OpenReader() const override;
 
 protected:
+	class ZipReader;
+
+	const std::string archiveName;
 	unzFile zip;
 
 	struct FileData {
@@ -30,6 +30,68 @@ std::vector<std::string> tokenizeString(const std::string& str, char c)
 	return res;
 }
 
+void tokenizeString(std::string_view str, char c, std::vector<std::string_view>& res)
+{
+	res.clear();
+	for (size_t pos = str.find(c); pos != std::string_view::npos; pos = str.find(c)) {
+		res.push_back(str.substr(0, pos));
+		str.remove_prefix(pos + 1);
+	}
+	res.push_back(str);
+}
+
+bool forEachGzLine(FILE* f, const std::string& path,
+                   const std::function<bool(std::string_view line)>& onLine)
+{
+	const int fd = fileSystem->dupFileFD(f);
+	if (fd < 0) {
+		return false;
+	}
+	gzFile fp = gzdopen(fd, "rb");
+	if (fp == Z_NULL) {
+		LOG_ERROR("Could not gzdopen %s", path.c_str());
+		return false;
+	}
+	gzbuffer(fp, 128 * 1024);
+
+	constexpr size_t blockSize = 256 * 1024;
+	std::vector<char> buf(blockSize);
+	size_t used = 0;  // bytes of incomplete line at the start of buf
+	bool ok = true;
+	while (ok) {
+		if (buf.size() - used < blockSize / 2) {
+			buf.resize(buf.size() * 2);
+		}
+		const int read = gzread(fp, buf.data() + used, buf.size() - used);
+		if (read <= 0) {
+			break;
+		}
+		const std::string_view data(buf.data(), used + read);
+		size_t start = 0;
+		for (size_t end = data.find('\n'); end != std::string_view::npos;
+		     end = data.find('\n', start)) {
+			if (!onLine(data.substr(start, end - start))) {
+				ok = false;
+				break;
+			}
+			start = end + 1;
+		}
+		used = data.size() - start;
+		memmove(buf.data(), buf.data() + start, used);
+	}
+	if (ok && used > 0) {
+		ok = onLine(std::string_view(buf.data(), used));
+	}
+	int errnum = Z_OK;
+	const char* errstr = gzerror(fp, &errnum);
+	if (errnum != Z_OK && errnum != Z_STREAM_END) {
+		LOG_ERROR("Decompression error in %s: %d %s", path.c_str(), errnum, errstr);
+		ok = false;
+	}
+	gzclose(fp);
+	return ok;
+}
+
 int gzip_str(const char* in, const int inlen, char* out, int* outlen)
 {
 	z_stream zlibStreamStruct;
@@ -58,7 +120,7 @@ int gzip_str(const char* in, const int inlen, char* out, int* outlen)
 	return Z_OK;
 }
 
-unsigned int parse_int32(unsigned char c[4])
+unsigned int parse_int32(const unsigned char c[4])
 {
 	unsigned int i = 0;
 	i = c[0] << 24 | i;
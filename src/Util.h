@@ -5,9 +5,17 @@
 #define HTTP_SEARCH_URL "https://springfiles.springrts.com/json.php"
 #define MAX_PARALLEL_DOWNLOADS 10
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
 #include <optional>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -25,6 +33,20 @@ std::string getUrl(const FileData* info, const std::string& path);
  */
 std::vector<std::string> tokenizeString(const std::string& str, char c);
 
+/**
+ * like tokenizeString, but returns views of str in res, so that the vector
+ * can be reused without allocations
+ */
+void tokenizeString(std::string_view str, char c, std::vector<std::string_view>& res);
+
+/**
+ * decompresses gzip compressed f in large blocks and calls onLine for every
+ * line, without the line end. Stops when onLine returns false.
+ * f isn't closed, path is used for error messages
+ */
+bool forEachGzLine(FILE* f, const std::string& path,
+                   const std::function<bool(std::string_view line)>& onLine);
+
 /**
  * decompresses in to out
  */
@@ -33,7 +55,7 @@ int gzip_str(const char* in, const int inlen, char* out, int* outlen);
 /**
  * parses an int, read from file or network
  */
-unsigned int parse_int32(unsigned char c[4]);
+unsigned int parse_int32(const unsigned char c[4]);
 
 /**
  * returns minimum
@@ -72,6 +94,22 @@ std::optional<std::string> getEnvVar(const std::string& name);
 std::pair<std::unordered_map<std::string, std::vector<std::string>>, std::vector<std::string>>
 parseArguments(int argc, char** argv, std::unordered_map<std::string, bool> const& valid_options);
 
+/**
+ * Computes the exponential retry duration to wait before making next request.
+ */
+template <class D1, class D2, class DR = typename std::common_type<D1, D2>::type>
+DR retryAfter(int retry_num, D1 base_delay, D2 max_delay, double factor = 2.0)
+{
+	static std::default_random_engine gen(std::random_device{}());
+	static std::uniform_real_distribution<> dis(0.7, 1.2);
+	if (retry_num <= 0) {
+		return DR(0);
+	}
+	auto backoff = base_delay * std::pow(factor, retry_num - 1) * dis(gen);
+	return std::min(std::chrono::duration_cast<DR>(backoff),
+	                std::chrono::duration_cast<DR>(max_delay));
+}
+
 class ArgumentParseEx : public std::runtime_error
 {
 public:
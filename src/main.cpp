@@ -18,7 +18,7 @@ void show_version()
 	LOG("pr-downloader %s (%s)\n", getVersion(), platformToString(PRD_CURRENT_PLATFORM));
 }
 
-const static std::array<std::tuple<std::string, bool, std::string>, 13> opts_array = {{
+const static std::array<std::tuple<std::string, bool, std::string>, 14> opts_array = {{
 	{"help", false, "Print this help message"},
 	{"version", false, "Show version of pr-downloader and quit"},
 	{"filesystem-writepath", true, "Set the directory with data, defaults to current dir"},
@@ -29,6 +29,9 @@ const static std::array<std::tuple<std::string, bool, std::string>, 13> opts_arr
 	{"download-engine", true, "Download engines by version"},
 	{"rapid-validate", false, "Validates correctness of files in rapid pool"},
 	{"delete", false, "Delete invalid files when executing --rapid-validate"},
+	{"full", false,
+     "Validate all files when executing --rapid-validate, not only ones new or changed since "
+     "previous validation"},
 	{"validate-sdp", true,
      "Validate correctness of files in Sdp archive, takes full path to the Sdp file"},
 	{"dump-sdp", true, "Dump contents of Sdp file, takes full path to the Sdp file"},
@@ -51,16 +54,27 @@ All --download-* flags can be specified multiple times which will download multi
 assets with a single invocation.
 
 Environment variables:
-  PRD_RAPID_USE_STREAMER=[true]|false
-      Whatever to use streamer.cgi for downloading.
+  PRD_RAPID_USE_STREAMER=[auto]|true|false
+      Whatever to use streamer.cgi for downloading. With auto it's chosen per
+      package based on number and size of files to download, and large files
+      can be fetched directly while the rest is streamed.
   PRD_RAPID_REPO_MASTER=[https://repos.springrts.com/repos.gz]
       URL of the rapid repo master.
+  PRD_RAPID_BACKGROUND_REFRESH=[false]|true
+      Answer searches from already downloaded rapid repo files and refresh
+      them in background, so that the next search sees the new data.
   PRD_MAX_HTTP_REQS_PER_SEC=[0]
       Limit on number of requests per second for HTTP downloading, 0 = unlimited
   PRD_HTTP_SEARCH_URL=[https://springfiles.springrts.com/json.php]
       URL of springfiles used to download maps etc.
   PRD_DISABLE_CERT_CHECK=[false]|true
       Allows to disable TLS certificate validation, useful for testing.
+  PRD_ENGINE_STORE=[false]|true
+      Hardlink files of extracted engines from a store shared by all engine
+      versions in the engine-store directory, instead of keeping a full copy
+      of every version. Files are matched by size, CRC32 and md5. Files stay
+      in the store when engine versions are removed, remove the directory to
+      free their space.
 )env";
 
 #ifndef NDEBUG
@@ -136,7 +150,8 @@ try {
 
 	if (args.count("rapid-validate")) {
 		const bool removeinvalid = args.count("delete");
-		if (!DownloadRapidValidate(removeinvalid)) {
+		const bool full = args.count("full");
+		if (!DownloadRapidValidate(removeinvalid, full)) {
 			LOG_ERROR("Validation of the rapid pool failed");
 			return 1;
 		}
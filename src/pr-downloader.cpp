@@ -11,11 +11,15 @@
 
 #include <assert.h>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
+#include <mutex>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -59,7 +63,6 @@ DownloadEnum::Category getPlatformEngineCat()
 
 bool download_engine(std::list<IDownload*>& dllist)
 {
-	bool res = true;
 	std::list<IDownload*> enginedls;
 
 	for (IDownload* dl : dllist) {
@@ -68,17 +71,58 @@ bool download_engine(std::list<IDownload*>& dllist)
 		}
 	}
 	if (enginedls.empty())
-		return res;
+		return true;
 
-	httpDownload->download(enginedls);
-	for (const IDownload* dl : enginedls) {
-		if (!dl->isFinished())
-			continue;
-		if (!fileSystem->extractEngine(dl->name, dl->version,
-		                               platformToString(PRD_CURRENT_PLATFORM))) {
-			LOG_ERROR("Failed to extract engine %s", dl->version.c_str());
-			res = false;
+	// Engines are extracted by a worker as soon as their download finishes,
+	// while the rest is still downloading.
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<const IDownload*> queue;
+	bool downloaded = false;
+	bool res = true;
+	std::thread extractor([&] {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			cv.wait(lock, [&] { return !queue.empty() || downloaded; });
+			if (queue.empty()) {
+				return;
+			}
+			const IDownload* dl = queue.front();
+			queue.pop_front();
+			lock.unlock();
+			const bool ok = fileSystem->extractEngine(dl->name, dl->version,
+			                                          platformToString(PRD_CURRENT_PLATFORM));
+			if (!ok) {
+				LOG_ERROR("Failed to extract engine %s", dl->version.c_str());
+			}
+			lock.lock();
+			res = res && ok;
+		}
+	});
+	const auto extract = [&](const IDownload& dl) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(&dl);
 		}
+		cv.notify_one();
+	};
+	for (IDownload* dl : enginedls) {
+		if (dl->isFinished()) {
+			extract(*dl);
+		} else {
+			dl->onFinished = extract;
+		}
+	}
+
+	httpDownload->download(enginedls);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		downloaded = true;
+	}
+	cv.notify_one();
+	extractor.join();
+	for (IDownload* dl : enginedls) {
+		dl->onFinished = nullptr;
 	}
 	return res;
 }
@@ -316,8 +360,8 @@ int DownloadStart()
 		return 1;
 	}
 	rapidDownload->download(dls);
-	httpDownload->download(dls, 1);
 	download_engine(dls);
+	httpDownload->download(dls, 1);
 	int res = 0;
 	for (const IDownload* dl : dls) {
 		if (dl->state != IDownload::STATE_FINISHED) {
@@ -328,9 +372,9 @@ int DownloadStart()
 	return res;
 }
 
-bool DownloadRapidValidate(bool deletebroken)
+bool DownloadRapidValidate(bool deletebroken, bool full)
 {
-	return fileSystem->validatePool(deletebroken);
+	return fileSystem->validatePool(deletebroken, full);
 }
 
 bool DownloadDumpSDP(const char* path)
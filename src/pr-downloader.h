@@ -86,8 +86,9 @@ extern bool DownloadGetConfig(CONFIG type, const void** value);
 /**
  * validate rapid pool
  * @param deletebroken files
+ * @param full validate also files unchanged since previous validation
  */
-extern bool DownloadRapidValidate(bool deletebroken);
+extern bool DownloadRapidValidate(bool deletebroken, bool full = false);
 
 /**
  * dump contents of a sdp
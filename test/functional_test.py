@@ -26,6 +26,8 @@ import binascii
 import gzip
 import hashlib
 import http.server
+import io
+import json
 import os
 import os.path
 import shutil
@@ -36,6 +38,8 @@ import tempfile
 import threading
 import time
 import unittest
+import urllib.parse
+import zipfile
 
 
 class RapidFile:
@@ -316,12 +320,18 @@ class HTTPHandler(http.server.SimpleHTTPRequestHandler):
             out.append(data)
 
         result = b''.join(out)
+        with self.server.streamer_lock:
+            self.server.streamer_requests.append(files_to_get)
+            # Simulates the connection breaking after sending only some bytes.
+            send_bytes = len(result)
+            if self.server.streamer_truncate:
+                send_bytes = self.server.streamer_truncate.pop(0)
 
         self.send_response(HTTPStatus.OK, "Ok")
         self.send_header('Content-Type', 'application/octet-stream')
         self.send_header('Content-Length', str(len(result)))
         self.end_headers()
-        self.wfile.write(result)
+        self.wfile.write(result[:send_bytes])
 
 
 Resolver = Callable[[HTTPHandler], tuple[bool, Optional[BinaryIO]]]
@@ -330,6 +340,11 @@ Resolver = Callable[[HTTPHandler], tuple[bool, Optional[BinaryIO]]]
 class TestingHTTPServer(http.server.ThreadingHTTPServer):
     directory: str
     rapid: Optional[RapidRoot]
+    # Bitmaps of files requested from the streamer, in order.
+    streamer_requests: list[list[bool]]
+    # Number of response bytes to send for the next streamer requests.
+    streamer_truncate: list[int]
+    streamer_lock: threading.Lock
     _resolvers: list[Resolver]
     _resolver_locks: list[threading.Lock]
 
@@ -338,6 +353,9 @@ class TestingHTTPServer(http.server.ThreadingHTTPServer):
         self._resolvers = []
         self._resolver_locks = []
         self.rapid = None
+        self.streamer_requests = []
+        self.streamer_truncate = []
+        self.streamer_lock = threading.Lock()
         super().__init__(('localhost', 0), self.create_handler)
 
     def create_handler(self, request: bytes, client_address: tuple[str, int],
@@ -405,9 +423,11 @@ class TestDownloading(unittest.TestCase):
     dest_root: str
     server: TestingHTTPServer
 
-    def call_rapid_download(self,
-                            shortnames: str | list[str],
-                            use_streamer: bool = False) -> int:
+    def call_pr_downloader(
+            self,
+            dl_args: list[str],
+            extra_env: Optional[dict[str, str]] = None) -> tuple[int, str]:
+        """Runs pr-downloader, returns exit code and its output."""
         with tempfile.NamedTemporaryFile(
                 prefix='pr-run-', delete=not self.keep_temp_files) as out:
             if self.keep_temp_files:
@@ -415,21 +435,14 @@ class TestDownloading(unittest.TestCase):
             env = {
                 'PRD_RAPID_REPO_MASTER':
                     f'{self.rapid.base_url}/{self.rapid.rapid_filename()}',
-                'PRD_RAPID_USE_STREAMER':
-                    'true' if use_streamer else 'false',
             }
+            env.update(extra_env or {})
             env.update(os.environ)
             if self.coverage_profiles_path is not None:
                 env['LLVM_PROFILE_FILE'] = os.path.join(
                     self.coverage_profiles_path,
                     f'{os.path.basename(out.name)}.profraw')
 
-            if isinstance(shortnames, str):
-                shortnames = [shortnames]
-            dl_args = []
-            for sn in shortnames:
-                dl_args.extend(['--download-game', sn])
-
             res = subprocess.run([
                 self.pr_downloader_path, '--filesystem-writepath',
                 self.dest_root
@@ -438,7 +451,84 @@ class TestDownloading(unittest.TestCase):
                                  stdout=out,
                                  timeout=10,
                                  env=env)
-            return res.returncode
+            out.seek(0)
+            return res.returncode, out.read().decode(errors='replace')
+
+    def call_rapid_download(self,
+                            shortnames: str | list[str],
+                            use_streamer: Optional[bool] = False,
+                            extra_env: Optional[dict[str, str]] = None) -> int:
+        env = {
+            'PRD_RAPID_USE_STREAMER':
+                'auto' if use_streamer is None else
+                'true' if use_streamer else 'false',
+        }
+        env.update(extra_env or {})
+
+        if isinstance(shortnames, str):
+            shortnames = [shortnames]
+        dl_args = []
+        for sn in shortnames:
+            dl_args.extend(['--download-game', sn])
+        return self.call_pr_downloader(dl_args, env)[0]
+
+    def serve_engines(self, engines: dict[str, bytes],
+                      bad_md5: Iterable[str] = ()) -> None:
+        """Serves engine archives by version over the http search api.
+
+        Versions in bad_md5 are advertised with a wrong md5.
+        """
+        engines_dir = os.path.join(self.serving_root, 'engines')
+        os.makedirs(engines_dir, exist_ok=True)
+        for version, contents in engines.items():
+            with open(os.path.join(engines_dir, f'{version}.zip'), 'wb') as f:
+                f.write(contents)
+
+        def resolver(handler: HTTPHandler) -> tuple[bool, Optional[BinaryIO]]:
+            url = urllib.parse.urlparse(handler.path)
+            if url.path != '/json.php':
+                return False, None
+            query = urllib.parse.parse_qs(url.query)
+            version = query['springname'][0]
+            result = []
+            if version in engines:
+                md5 = hashlib.md5(engines[version]).hexdigest()
+                result.append({
+                    'category': query['category'][0],
+                    'springname': version,
+                    'version': version,
+                    'filename': f'{version}.zip',
+                    'mirrors': [f'{self.rapid.base_url}/engines/{version}.zip'],
+                    'md5': md5[::-1] if version in bad_md5 else md5,
+                })
+            body = json.dumps(result).encode()
+            handler.send_response(HTTPStatus.OK)
+            handler.send_header("Content-Type", "application/json")
+            handler.send_header("Content-Length", str(len(body)))
+            handler.end_headers()
+            return True, io.BytesIO(body)
+
+        self.server.add_resolver(resolver)
+
+    def call_engine_download(self, versions: list[str]) -> tuple[int, str]:
+        dl_args = []
+        for v in versions:
+            dl_args.extend(['--download-engine', v])
+        return self.call_pr_downloader(
+            dl_args, {'PRD_HTTP_SEARCH_URL': f'{self.rapid.base_url}/json.php'})
+
+    def extracted_engines(self) -> dict[str, str]:
+        """Returns extracted engine directories by version."""
+        engine_root = os.path.join(self.dest_root, 'engine')
+        res: dict[str, str] = {}
+        if not os.path.isdir(engine_root):
+            return res
+        for platform in os.listdir(engine_root):
+            platform_dir = os.path.join(engine_root, platform)
+            if os.path.isdir(platform_dir):
+                for version in os.listdir(platform_dir):
+                    res[version] = os.path.join(platform_dir, version)
+        return res
 
     def verify_downloaded_rapid(self, archive: str | Archive) -> bool:
         if isinstance(archive, str):
@@ -607,21 +697,31 @@ class TestDownloading(unittest.TestCase):
 
         self.assertTrue(self.verify_downloaded_rapid('base:stable'))
 
-    def test_multiple_packages_single_invocation(self) -> None:
+    def _base_multiple_packages_single_invocation(self,
+                                                  use_streamer: bool) -> None:
         repo = self.rapid.add_repo('base')
         num_archives = 10
         for i in range(num_archives):
             archive = repo.add_archive(f'pkg:{i}')
             archive.add_file('f.txt', str(i).encode())
+            archive.add_file('shared.txt', b'shared')
         self.rapid.save(self.serving_root)
         packages = [f'base:pkg:{i}' for i in range(num_archives)]
 
         with self.server.serve():
-            self.assertEqual(self.call_rapid_download(packages), 0)
+            self.assertEqual(
+                self.call_rapid_download(packages, use_streamer=use_streamer),
+                0)
 
         for pkg in packages:
             self.assertTrue(self.verify_downloaded_rapid(pkg))
 
+    def test_multiple_packages_single_invocation(self) -> None:
+        self._base_multiple_packages_single_invocation(use_streamer=False)
+
+    def test_multiple_packages_single_invocation_streamer(self) -> None:
+        self._base_multiple_packages_single_invocation(use_streamer=True)
+
     def test_redownload_is_ok(self) -> None:
         repo = self.rapid.add_repo('repo')
         archive = repo.add_archive('pkg')
@@ -815,20 +915,213 @@ class TestDownloading(unittest.TestCase):
             self.assertEqual(self.call_rapid_download('repo:pkg'), 0)
             self.assertTrue(visited_file)
 
-    # TODO(marekr): Fix bugs that are being reproduced by the tests below.
+    def test_background_refresh_uses_cached_repos(self) -> None:
+        repo = self.rapid.add_repo('repo')
+        archive = repo.add_archive('pkg:1')
+        archive.add_file('a.txt', b'a')
+        self.rapid.save(self.serving_root)
+        env = {'PRD_RAPID_BACKGROUND_REFRESH': 'true'}
+
+        with self.server.serve():
+            self.assertEqual(
+                self.call_rapid_download('repo:pkg:1', extra_env=env), 0)
+            self.assertTrue(self.verify_downloaded_rapid('repo:pkg:1'))
+
+            archive = repo.add_archive('pkg:2')
+            archive.add_file('b.txt', b'b')
+            self.rapid.save(self.serving_root)
+            # Answered from the cached versions.gz, which is refreshed for
+            # the next run.
+            self.assertNotEqual(
+                self.call_rapid_download('repo:pkg:2', extra_env=env), 0)
+            self.assertEqual(
+                self.call_rapid_download('repo:pkg:2', extra_env=env), 0)
+
+        self.assertTrue(self.verify_downloaded_rapid('repo:pkg:2'))
+
+    def test_untagged_names_routed_to_known_repos(self) -> None:
+        game = self.rapid.add_repo('game')
+        game.add_archive('test-1', 'Game test-1').add_file('a.txt', b'a')
+        other = self.rapid.add_repo('other')
+        other.add_archive('test-1', 'Other test-1').add_file('b.txt', b'b')
+        self.rapid.save(self.serving_root)
+
+        requested_repos = set()
+
+        def resolver(handler: HTTPHandler) -> tuple[bool, Optional[BinaryIO]]:
+            if handler.path.endswith('/versions.gz'):
+                requested_repos.add(handler.path.split('/')[-2])
+            return False, None
+
+        self.server.add_resolver(resolver)
+        with self.server.serve():
+            self.assertEqual(self.call_rapid_download('Game test-1'), 0)
+            self.assertEqual(requested_repos, {'game', 'other'})
+
+            # Only the repo which had packages with the same prefix is checked.
+            game.add_archive('test-2', 'Game test-2').add_file('c.txt', b'c')
+            self.rapid.save(self.serving_root)
+            requested_repos.clear()
+            self.assertEqual(self.call_rapid_download('Game test-2'), 0)
+            self.assertEqual(requested_repos, {'game'})
+
+            # Falls back to all repos when the routed ones don't have it.
+            other.add_archive('test-3', 'Game test-3').add_file('d.txt', b'd')
+            self.rapid.save(self.serving_root)
+            requested_repos.clear()
+            self.assertEqual(self.call_rapid_download('Game test-3'), 0)
+            self.assertEqual(requested_repos, {'game', 'other'})
+
+        self.assertTrue(self.verify_downloaded_rapid('game:test-2'))
+        self.assertTrue(self.verify_downloaded_rapid('other:test-3'))
+
+    def test_streamer_interrupted_retries_remaining_files(self) -> None:
+        repo = self.rapid.add_repo('testrepo')
+        archive = repo.add_archive('pkg:1')
+        archive.add_file('a.txt', b'a' * 1000)
+        archive.add_file('b.txt', b'b' * 1000)
+        archive.add_file('c.txt', b'c' * 1000)
+        self.rapid.save(self.serving_root)
+
+        # Break the first response in the middle of the second file.
+        first_len = len(archive.files['a.txt'].get_contents())
+        self.server.streamer_truncate = [4 + first_len + 10]
 
-    # def test_streamer_not_returning_all_files_fails(self) -> None:
-    #     repo = self.rapid.add_repo('testrepo')
-    #     archive = repo.add_archive('pkg:1')
-    #     archive.add_file('a.txt', b'a')
-    #     archive.add_file('b.txt', b'aa')
-    #     self.rapid.save(self.serving_root)
+        with self.server.serve():
+            self.assertEqual(
+                self.call_rapid_download('testrepo:pkg:1', use_streamer=True),
+                0)
+        self.assertTrue(self.verify_downloaded_rapid('testrepo:pkg:1'))
+        self.assertEqual(len(self.server.streamer_requests), 2)
+        self.assertEqual(self.server.streamer_requests[0][:3],
+                         [True, True, True])
+        self.assertEqual(self.server.streamer_requests[1][:3],
+                         [False, True, True])
 
-    #     del archive.files['b.txt']
+    def test_auto_transfer_mode_fetches_large_files_over_http(self) -> None:
+        repo = self.rapid.add_repo('testrepo')
+        archive = repo.add_archive('pkg:1')
+        for i in range(20):
+            archive.add_file(f'{i:02}.txt', f'small{i}'.encode())
+        archive.add_file('large.bin', b'x' * (5 * 1024 * 1024))
+        self.rapid.save(self.serving_root)
 
-    #     with self.server.serve():
-    #         self.assertNotEqual(
-    #             self.call_rapid_download('testrepo:pkg:1'), 0)
+        with self.server.serve():
+            self.assertEqual(
+                self.call_rapid_download('testrepo:pkg:1', use_streamer=None),
+                0)
+        self.assertTrue(self.verify_downloaded_rapid('testrepo:pkg:1'))
+        self.assertEqual(len(self.server.streamer_requests), 1)
+        self.assertEqual(self.server.streamer_requests[0][:21],
+                         [True] * 20 + [False])
+
+    def test_auto_transfer_mode_few_files_use_http(self) -> None:
+        repo = self.rapid.add_repo('testrepo')
+        archive = repo.add_archive('pkg:1')
+        archive.add_file('a.txt', b'a')
+        archive.add_file('b.txt', b'b')
+        self.rapid.save(self.serving_root)
+
+        with self.server.serve():
+            self.assertEqual(
+                self.call_rapid_download('testrepo:pkg:1', use_streamer=None),
+                0)
+        self.assertTrue(self.verify_downloaded_rapid('testrepo:pkg:1'))
+        self.assertEqual(len(self.server.streamer_requests), 0)
+
+    def test_streamer_failing_falls_back_to_http(self) -> None:
+        repo = self.rapid.add_repo('testrepo')
+        archive = repo.add_archive('pkg:1')
+        archive.add_file('a.txt', b'a')
+        archive.add_file('b.txt', b'aa')
+        self.rapid.save(self.serving_root)
+
+        # Streamer never manages to send more than the first file.
+        first_len = len(archive.files['a.txt'].get_contents())
+        self.server.streamer_truncate = [4 + first_len] * 10
+
+        with self.server.serve():
+            self.assertEqual(
+                self.call_rapid_download('testrepo:pkg:1', use_streamer=True),
+                0)
+        self.assertTrue(self.verify_downloaded_rapid('testrepo:pkg:1'))
+        self.assertEqual(len(self.server.streamer_requests), 4)
+        self.assertEqual(self.server.streamer_requests[3][:2], [False, True])
+
+    def test_streamer_not_returning_all_files_fails(self) -> None:
+        repo = self.rapid.add_repo('testrepo')
+        archive = repo.add_archive('pkg:1')
+        archive.add_file('a.txt', b'a')
+        archive.add_file('b.txt', b'aa')
+        self.rapid.save(self.serving_root)
+
+        # File is missing on the server, so also the HTTP fallback fails.
+        del archive.files['b.txt']
+
+        with self.server.serve():
+            self.assertNotEqual(
+                self.call_rapid_download('testrepo:pkg:1', use_streamer=True),
+                0)
+
+
+    @staticmethod
+    def engine_zip(files: dict[str, bytes]) -> bytes:
+        buf = io.BytesIO()
+        with zipfile.ZipFile(buf, 'w') as z:
+            for name, contents in files.items():
+                z.writestr(name, contents)
+        return buf.getvalue()
+
+    def test_engine_download_extracted(self) -> None:
+        self.rapid.add_repo('testrepo')
+        self.rapid.save(self.serving_root)
+        self.serve_engines({
+            '105.1': self.engine_zip({
+                'spring': b'binary1',
+                'base/a.txt': b'a'
+            }),
+            '105.2': self.engine_zip({'spring': b'binary2'}),
+        })
+
+        with self.server.serve():
+            res, out = self.call_engine_download(['105.1', '105.2'])
+        self.assertEqual(res, 0)
+
+        engines = self.extracted_engines()
+        self.assertEqual(sorted(engines), ['105.1', '105.2'])
+        with open(os.path.join(engines['105.1'], 'spring'), 'rb') as f:
+            self.assertEqual(f.read(), b'binary1')
+        with open(os.path.join(engines['105.1'], 'base', 'a.txt'), 'rb') as f:
+            self.assertEqual(f.read(), b'a')
+        with open(os.path.join(engines['105.2'], 'spring'), 'rb') as f:
+            self.assertEqual(f.read(), b'binary2')
+        # Each verified download is extracted exactly once.
+        self.assertEqual(out.count('Extracting '), 2)
+
+    def test_engine_failed_download_not_extracted(self) -> None:
+        self.rapid.add_repo('testrepo')
+        self.rapid.save(self.serving_root)
+        self.serve_engines({'105.1': self.engine_zip({'spring': b'binary1'})})
+        self.server.add_resolver(
+            fail_requests_resolver({'/engines/105.1.zip': HTTPStatus.NOT_FOUND}))
+
+        with self.server.serve():
+            res, out = self.call_engine_download(['105.1'])
+        self.assertNotEqual(res, 0)
+        self.assertEqual(self.extracted_engines(), {})
+        self.assertEqual(out.count('Extracting '), 0)
+
+    def test_engine_hash_mismatch_not_extracted(self) -> None:
+        self.rapid.add_repo('testrepo')
+        self.rapid.save(self.serving_root)
+        self.serve_engines({'105.1': self.engine_zip({'spring': b'binary1'})},
+                           bad_md5=['105.1'])
+
+        with self.server.serve():
+            res, out = self.call_engine_download(['105.1'])
+        self.assertNotEqual(res, 0)
+        self.assertEqual(self.extracted_engines(), {})
+        self.assertEqual(out.count('Extracting '), 0)
 
 
 if __name__ == '__main__':
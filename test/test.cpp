@@ -3,17 +3,34 @@
 #include <unordered_map>
 #define BOOST_TEST_MODULE Float3
 #include <algorithm>
+#include <array>
 #include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <memory>
 #include <optional>
 #include <random>
 #include <string>
+#include <string_view>
+#include <zlib.h>
 
+#include "Downloader/Http/ETag.h"
 #include "Downloader/Http/IOThreadPool.h"
+#include "Downloader/IDownloader.h"
+#include "Downloader/ProgressTracker.h"
+#include "Downloader/Rapid/StringArena.h"
+#include "FileSystem/ContentStore.h"
+#include "FileSystem/FileIdentity.h"
 #include "FileSystem/FileSystem.h"
+#include "FileSystem/FileTable.h"
 #include "FileSystem/HashGzip.h"
 #include "FileSystem/HashMD5.h"
+#include "FileSystem/Md5Set.h"
+#include "FileSystem/PoolIndex.h"
+#include "FileSystem/ValidationJournal.h"
 #include "Util.h"
+#include "minizip/zip.h"
 
 BOOST_AUTO_TEST_CASE(EscapeFilenameTest)
 {
@@ -22,6 +39,55 @@ BOOST_AUTO_TEST_CASE(EscapeFilenameTest)
 	BOOST_CHECK("abC123" == CFileSystem::EscapeFilename("abC123"));
 }
 
+BOOST_AUTO_TEST_CASE(TokenizeStringTest)
+{
+	using Views = std::vector<std::string_view>;
+	Views res;
+	tokenizeString("a,,b,", ',', res);
+	BOOST_CHECK(res == (Views{"a", "", "b", ""}));
+	tokenizeString("", ',', res);
+	BOOST_CHECK(res == (Views{""}));
+	BOOST_CHECK(tokenizeString(std::string("a,,b,"), ',') ==
+	            (std::vector<std::string>{"a", "", "b", ""}));
+}
+
+BOOST_AUTO_TEST_CASE(StringArenaTest)
+{
+	StringArena arena;
+	std::string str = "stable";
+	const std::string_view a = arena.intern(str);
+	str = "changed";
+	BOOST_CHECK(a == "stable");
+	BOOST_CHECK(a.data()[a.size()] == '\0');
+	BOOST_CHECK(arena.intern("stable").data() == a.data());
+	const std::string big(100 * 1024, 'x');
+	BOOST_CHECK(arena.intern(big) == big);
+	BOOST_CHECK(arena.intern("") == "");
+}
+
+BOOST_AUTO_TEST_CASE(ForEachGzLineTest)
+{
+	const auto path = std::filesystem::temp_directory_path() / "prd-gz-lines-test.gz";
+	const std::string longLine(300 * 1024, 'x');
+	const std::string content = "a,b\n\n" + longLine + "\nlast";
+	{
+		gzFile out = gzopen(pathToU8(path).c_str(), "wb");
+		BOOST_REQUIRE(out != Z_NULL);
+		gzwrite(out, content.data(), content.size());
+		gzclose(out);
+	}
+	std::vector<std::string> lines;
+	FILE* f = fopen(pathToU8(path).c_str(), "rb");
+	BOOST_REQUIRE(f != nullptr);
+	BOOST_CHECK(forEachGzLine(f, pathToU8(path), [&](std::string_view line) {
+		lines.emplace_back(line);
+		return true;
+	}));
+	fclose(f);
+	BOOST_CHECK(lines == (std::vector<std::string>{"a,b", "", longLine, "last"}));
+	std::filesystem::remove(path);
+}
+
 BOOST_AUTO_TEST_CASE(HashGzipTest)
 {
 	// Uncompressed output is:
@@ -108,6 +174,50 @@ BOOST_AUTO_TEST_CASE(IOThreadPoolTest)
 	}
 }
 
+static std::vector<std::pair<int, int>> reportedProgress;
+
+static void recordProgress(int done, int total)
+{
+	reportedProgress.emplace_back(done, total);
+}
+
+BOOST_AUTO_TEST_CASE(ProgressTrackerTest)
+{
+	reportedProgress.clear();
+	IDownloader::setProcessUpdateListener(recordProgress);
+	ProgressTracker progress;
+	progress.addTotal(1000);
+	progress.addTotal(500);
+	// Only the first of quick updates is reported.
+	for (int i = 0; i < 100; ++i) {
+		progress.addDone(10);
+		progress.report();
+	}
+	BOOST_CHECK(reportedProgress.size() == 1);
+	BOOST_CHECK(reportedProgress[0] == std::make_pair(10, 1500));
+	progress.report(/*force=*/true);
+	BOOST_CHECK(reportedProgress.back() == std::make_pair(1000, 1500));
+	// Finishing is always reported, but only once.
+	progress.addDone(500);
+	progress.report();
+	progress.report();
+	BOOST_CHECK(reportedProgress.size() == 3);
+	BOOST_CHECK(reportedProgress.back() == std::make_pair(1500, 1500));
+	// Retried transfer can lower the progress.
+	progress.addDone(-200);
+	BOOST_CHECK(progress.getDone() == 1300);
+	// Unknown total isn't treated as finished.
+	reportedProgress.clear();
+	ProgressTracker unknown;
+	unknown.report();
+	unknown.addTotal(100);
+	unknown.addDone(100);
+	unknown.report();
+	BOOST_CHECK(reportedProgress.size() == 2);
+	BOOST_CHECK(reportedProgress.back() == std::make_pair(100, 100));
+	IDownloader::setProcessUpdateListener(nullptr);
+}
+
 BOOST_AUTO_TEST_CASE(ParseArgumentsTest)
 {
 	using ArgsT = std::unordered_map<std::string, std::vector<std::string>>;
@@ -158,3 +268,436 @@ BOOST_AUTO_TEST_CASE(ParseArgumentsTest)
 		BOOST_CHECK_THROW(parseArguments(argc, const_cast<char**>(argv), opts), ArgumentParseEx);
 	}
 }
+
+BOOST_AUTO_TEST_CASE(Md5SetTest)
+{
+	std::default_random_engine gen(42);
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<std::array<unsigned char, 16>> md5s(10000);
+	for (auto& md5 : md5s) {
+		for (auto& b : md5) {
+			b = byte(gen);
+		}
+	}
+	// Keys differing only in part not used for hashing and all zeros key.
+	md5s[1] = md5s[0];
+	md5s[1][15] ^= 1;
+	md5s[2] = {};
+
+	Md5Set set;
+	for (size_t i = 0; i < md5s.size() / 2; ++i) {
+		BOOST_CHECK(set.insert(md5s[i].data()));
+	}
+	for (size_t i = 0; i < md5s.size(); ++i) {
+		BOOST_CHECK(set.contains(md5s[i].data()) == (i < md5s.size() / 2));
+	}
+	BOOST_CHECK(!set.insert(md5s[0].data()));
+	BOOST_CHECK(!set.insert(md5s[2].data()));
+	BOOST_CHECK(set.size() == md5s.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(PoolIndexTest)
+{
+	const auto root = std::filesystem::temp_directory_path() / "prd-pool-index-test";
+	std::filesystem::remove_all(root);
+	const std::string pool = pathToU8(root) + PATH_DELIMITER;
+	const auto poolPath = [&](const std::string& md5) {
+		return pool + md5.substr(0, 2) + PATH_DELIMITER + md5.substr(2) + ".gz";
+	};
+	const auto addFile = [&](const std::string& md5, size_t size) {
+		std::filesystem::create_directories(pool + md5.substr(0, 2));
+		const std::string path = poolPath(md5);
+		std::ofstream(path, std::ios::binary) << std::string(size, 'x');
+		return path;
+	};
+	const auto setDirTime = [&](const std::string& md5, std::filesystem::file_time_type time) {
+		std::filesystem::last_write_time(u8ToPath(pool + md5.substr(0, 2)), time);
+	};
+	const auto loadMd5s = [&]() {
+		std::vector<std::pair<std::string, uint64_t>> res;
+		const auto entries = PoolIndex(pool).Load();
+		BOOST_REQUIRE(entries);
+		for (const auto& entry : *entries) {
+			HashMD5 md5;
+			md5.Set(entry.md5, sizeof(entry.md5));
+			res.emplace_back(md5.toString(), entry.size);
+		}
+		return res;
+	};
+	using Expected = std::vector<std::pair<std::string, uint64_t>>;
+
+	const std::string md5a = "00aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+	const std::string md5b = "ab000000000000000000000000000000";
+	const std::string md5c = "abffffffffffffffffffffffffffffff";
+	addFile(md5b, 20);
+	addFile(md5a, 10);
+	addFile("ab", 1);  // not a pool file
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5b, 20}}));
+	BOOST_CHECK(std::filesystem::exists(root / "pool-index.bin"));
+
+	// Commited files are recorded in log
+	{
+		PoolIndex index(pool);
+		const int64_t mtime = PoolIndex::DirMtime(poolPath(md5c));
+		index.RecordCommit(addFile(md5c, 30), mtime);
+		index.RecordCommit(pool + "unrelated.gz", mtime);
+	}
+	BOOST_CHECK(std::filesystem::file_size(root / "pool-index.log") > 0);
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5b, 20}, {md5c, 30}}));
+	BOOST_CHECK(std::filesystem::file_size(root / "pool-index.log") == 0);
+
+	// Changes done outside are detected
+	std::filesystem::remove(pool + "ab" + PATH_DELIMITER + md5b.substr(2) + ".gz");
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5c, 30}}));
+
+	// Broken index is rebuilt
+	std::ofstream(root / "pool-index.bin", std::ios::binary) << "garbage";
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5c, 30}}));
+
+	// Log doesn't hide files removed before a commit to the same directory.
+	using namespace std::chrono_literals;
+	const auto past = std::filesystem::file_time_type::clock::now() - 1h;
+	setDirTime(md5a, past);
+	setDirTime(md5c, past);
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5c, 30}}));
+	{
+		PoolIndex index(pool);
+		std::filesystem::remove(poolPath(md5c));
+		setDirTime(md5c, past + 1s);
+		const int64_t mtime = PoolIndex::DirMtime(poolPath(md5b));
+		addFile(md5b, 20);
+		setDirTime(md5b, past + 2s);
+		index.RecordCommit(poolPath(md5b), mtime);
+	}
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5b, 20}}));
+
+	// Nor files removed right after a commit, within the same timestamp.
+	{
+		PoolIndex index(pool);
+		const int64_t mtime = PoolIndex::DirMtime(poolPath(md5c));
+		index.RecordCommit(addFile(md5c, 30), mtime);
+		const auto committed = std::filesystem::last_write_time(u8ToPath(pool + "ab"));
+		std::filesystem::remove(poolPath(md5b));
+		setDirTime(md5b, committed);
+	}
+	BOOST_CHECK(loadMd5s() == (Expected{{md5a, 10}, {md5c, 30}}));
+
+	std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(ValidationJournalTest)
+{
+	const auto root = std::filesystem::temp_directory_path() / "prd-validation-journal-test";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	const std::string journalPath = pathToU8(root / "journal.bin");
+	const std::string filePath = pathToU8(root / "file.gz");
+	std::ofstream(filePath, std::ios::binary) << "content";
+	const unsigned char md5a[16] = {1};
+	const unsigned char md5b[16] = {2};
+	const auto identity = getFileIdentity(filePath);
+	BOOST_REQUIRE(identity);
+	BOOST_CHECK(!getFileIdentity(pathToU8(root / "missing.gz")));
+
+	{
+		ValidationJournal journal(journalPath);
+		journal.Load();
+		BOOST_CHECK(!journal.Check(md5a, *identity));
+		journal.Add(md5a, *identity);
+		BOOST_CHECK(journal.Save());
+	}
+	{
+		ValidationJournal journal(journalPath);
+		journal.Load();
+		BOOST_CHECK(journal.Check(md5a, *identity));
+		BOOST_CHECK(!journal.Check(md5b, *identity));
+		FileIdentity changed = *identity;
+		changed.size += 1;
+		BOOST_CHECK(!journal.Check(md5a, changed));
+		BOOST_CHECK(journal.Save());
+	}
+	// Records which were checked are kept
+	{
+		ValidationJournal journal(journalPath);
+		journal.Load();
+		BOOST_CHECK(journal.Check(md5a, *identity));
+	}
+
+	// Broken journal is ignored
+	std::ofstream(journalPath, std::ios::binary) << "garbage";
+	{
+		ValidationJournal journal(journalPath);
+		journal.Load();
+		BOOST_CHECK(!journal.Check(md5a, *identity));
+	}
+
+	std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(FileTableTest)
+{
+	FileTable files;
+	const unsigned char md5[16] = {1};
+	const unsigned char crc32[4] = {2};
+	for (int i = 0; i < 130; ++i) {
+		files.add(i % 2 == 0 ? "" : std::to_string(i), md5, crc32, i);
+	}
+	BOOST_CHECK(files.size() == 130);
+	BOOST_CHECK(files.name(0).empty());
+	BOOST_CHECK(files.name(129) == "129");
+	BOOST_CHECK(files.fileSize(64) == 64);
+	BOOST_CHECK(files.md5(100)[0] == 1);
+	BOOST_CHECK(files.crc32(100)[0] == 2);
+
+	BOOST_CHECK(files.nextDownload(0) == FileTable::NPOS);
+	files.setDownload(3, true);
+	files.setDownload(64, true);
+	files.setDownload(129, true);
+	BOOST_CHECK(files.download(64));
+	BOOST_CHECK(files.nextDownload(0) == 3);
+	BOOST_CHECK(files.nextDownload(4) == 64);
+	BOOST_CHECK(files.nextDownload(65) == 129);
+	BOOST_CHECK(files.nextDownload(130) == FileTable::NPOS);
+	files.setDownload(129, false);
+	BOOST_CHECK(!files.hasDownloads(65));
+
+	FileTable copy;
+	BOOST_CHECK(copy.assign(files.size(), files.md5Data(), files.crc32Data(), files.sizeData(),
+	                        files.nameEndData(), files.namesData()));
+	BOOST_CHECK(copy.name(129) == "129");
+	BOOST_CHECK(copy.fileSize(129) == 129);
+	BOOST_CHECK(!copy.hasDownloads());
+	// Names must match the name ends.
+	BOOST_CHECK(!copy.assign(files.size(), files.md5Data(), files.crc32Data(), files.sizeData(),
+	                         files.nameEndData(), "x"));
+	BOOST_CHECK(copy.empty());
+}
+
+BOOST_AUTO_TEST_CASE(ParseSdpTest)
+{
+	const auto root = std::filesystem::temp_directory_path() / "prd-parse-sdp-test";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root / "packages");
+	BOOST_REQUIRE(fileSystem->setWritePath(pathToU8(root)));
+
+	std::string content;
+	HashMD5 sdpMd5;
+	sdpMd5.Init();
+	for (const std::string name : {"a.txt", "dir/b.txt"}) {
+		unsigned char md5[16] = {static_cast<unsigned char>(name.size())};
+		const unsigned char crcAndSize[8] = {1, 2, 3, 4, 0, 0, 1, 2};
+		content += static_cast<char>(name.size()) + name;
+		content.append(reinterpret_cast<const char*>(md5), sizeof(md5));
+		content.append(reinterpret_cast<const char*>(crcAndSize), sizeof(crcAndSize));
+		HashMD5 nameMd5;
+		nameMd5.Init();
+		nameMd5.Update(name.data(), name.size());
+		nameMd5.Final();
+		sdpMd5.Update(reinterpret_cast<const char*>(nameMd5.Data()), nameMd5.getSize());
+		sdpMd5.Update(reinterpret_cast<const char*>(md5), sizeof(md5));
+	}
+	sdpMd5.Final();
+	const std::string sdpPath = pathToU8(root / "packages" / (sdpMd5.toString() + ".sdp"));
+	const auto writeSdp = [&](const std::string& data) {
+		gzFile out = gzopen(sdpPath.c_str(), "wb");
+		BOOST_REQUIRE(out != Z_NULL);
+		gzwrite(out, data.data(), data.size());
+		gzclose(out);
+	};
+	const auto checkFiles = [&]() {
+		FileTable files;
+		BOOST_REQUIRE(fileSystem->parseSdp(sdpPath, files));
+		BOOST_REQUIRE(files.size() == 2);
+		BOOST_CHECK(files.name(0) == "a.txt");
+		BOOST_CHECK(files.name(1) == "dir/b.txt");
+		BOOST_CHECK(files.md5(1)[0] == 9);
+		BOOST_CHECK(files.crc32(1)[3] == 4);
+		BOOST_CHECK(files.fileSize(1) == 258);
+		BOOST_CHECK(!files.hasDownloads());
+	};
+	writeSdp(content);
+
+	// First parse creates the index, second one uses it.
+	checkFiles();
+	BOOST_CHECK(std::filesystem::exists(sdpPath + "idx"));
+	checkFiles();
+
+	// Broken index is ignored and rewritten.
+	std::ofstream(sdpPath + "idx", std::ios::binary) << "garbage";
+	checkFiles();
+	BOOST_CHECK(std::filesystem::file_size(sdpPath + "idx") > 7);
+
+	// Index of previous version of the sdp is not used.
+	writeSdp(content.substr(0, content.size() - 1));
+	FileTable files;
+	BOOST_CHECK(!fileSystem->parseSdp(sdpPath, files));
+
+	std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(ETagTest)
+{
+	const auto root = std::filesystem::temp_directory_path() / "prd-etag-test";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	const std::string path = pathToU8(root / "file");
+	const std::string etagPath = path + ".etag";
+	std::ofstream(path, std::ios::binary) << "contents";
+	HashMD5 md5;
+	BOOST_REQUIRE(fileSystem->hashFile(&md5, path));
+	const std::string wrongMd5(32, '0');
+	const auto readRecord = [&]() {
+		std::string line;
+		std::getline(std::ifstream(etagPath, std::ios::binary), line);
+		return line;
+	};
+	const auto identityRecord = [&]() {
+		const auto identity = getFileIdentity(path);
+		BOOST_REQUIRE(identity);
+		return std::to_string(identity->inode) + " " + std::to_string(identity->size) + " " +
+		       std::to_string(identity->mtime);
+	};
+
+	// Matching identity is trusted, the file isn't hashed: the recorded md5 is never compared.
+	setETag(path, "\"a\"", wrongMd5);
+	BOOST_CHECK(readRecord() == wrongMd5 + " " + identityRecord() + ":\"a\"");
+	BOOST_CHECK(getETag(path) == std::optional<std::string>("\"a\""));
+
+	// Legacy record is verified by md5 and upgraded to include the identity.
+	std::ofstream(etagPath, std::ios::binary) << md5.toString() << ":\"b\"";
+	BOOST_CHECK(getETag(path) == std::optional<std::string>("\"b\""));
+	BOOST_CHECK(readRecord() == md5.toString() + " " + identityRecord() + ":\"b\"");
+
+	// Legacy record with a different md5 is ignored.
+	std::ofstream(etagPath, std::ios::binary) << wrongMd5 << ":\"c\"";
+	BOOST_CHECK(!getETag(path));
+
+	// Changed file doesn't match its identity nor md5 anymore.
+	setETag(path, "\"d\"", md5.toString());
+	BOOST_CHECK(getETag(path) == std::optional<std::string>("\"d\""));
+	std::ofstream(path, std::ios::binary) << "changed contents";
+	BOOST_CHECK(!getETag(path));
+
+	std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(ExtractZipTest)
+{
+	const auto root = std::filesystem::temp_directory_path() / "prd-extract-zip-test";
+	std::filesystem::remove_all(root);
+	std::filesystem::create_directories(root);
+	const std::string zipPath = pathToU8(root / "archive.zip");
+	const auto content = [](int i) { return std::string(i * 100, 'a' + i % 26); };
+	constexpr int numFiles = 50;
+	{
+		zipFile zip = zipOpen(zipPath.c_str(), APPEND_STATUS_CREATE);
+		BOOST_REQUIRE(zip != nullptr);
+		for (int i = 0; i < numFiles; ++i) {
+			const std::string name =
+				"dir" + std::to_string(i % 5) + "/sub/file" + std::to_string(i) + ".txt";
+			BOOST_REQUIRE(zipOpenNewFileInZip(zip, name.c_str(), nullptr, nullptr, 0, nullptr, 0,
+			                                  nullptr, Z_DEFLATED, Z_DEFAULT_COMPRESSION) == ZIP_OK);
+			const std::string data = content(i);
+			zipWriteInFileInZip(zip, data.data(), data.size());
+			zipCloseFileInZip(zip);
+		}
+		zipClose(zip, nullptr);
+	}
+	const auto readFile = [&](int i) {
+		std::ifstream in(root / "out" / ("dir" + std::to_string(i % 5)) / "sub" /
+		                 ("file" + std::to_string(i) + ".txt"));
+		return std::string(std::istreambuf_iterator<char>(in), {});
+	};
+
+	const std::string outDir = pathToU8(root / "out");
+	BOOST_REQUIRE(fileSystem->extract(zipPath, outDir));
+	for (int i = 0; i < numFiles; ++i) {
+		BOOST_CHECK(readFile(i) == content(i));
+	}
+
+	// Existing files are kept unless overwrite is set.
+	const auto modified = root / "out" / "dir3" / "sub" / "file3.txt";
+	std::ofstream(modified) << "modified";
+	BOOST_REQUIRE(fileSystem->extract(zipPath, outDir));
+	BOOST_CHECK(readFile(3) == "modified");
+	// Overwriting writes only files which differ from the archive.
+	const auto unchanged = root / "out" / "dir4" / "sub" / "file4.txt";
+	const auto oldTime = std::filesystem::last_write_time(unchanged) - std::chrono::hours(1);
+	std::filesystem::last_write_time(unchanged, oldTime);
+	BOOST_REQUIRE(fileSystem->extract(zipPath, outDir, /*overwrite=*/true));
+	BOOST_CHECK(readFile(3) == content(3));
+	BOOST_CHECK(std::filesystem::last_write_time(unchanged) == oldTime);
+
+	// Files are streamed in chunks and their CRC is checked.
+	const std::string big(1024 * 1024 + 7, 'b');
+	const std::string brokenZipPath = pathToU8(root / "broken.zip");
+	{
+		zipFile zip = zipOpen(brokenZipPath.c_str(), APPEND_STATUS_CREATE);
+		BOOST_REQUIRE(zip != nullptr);
+		BOOST_REQUIRE(zipOpenNewFileInZip(zip, "big.txt", nullptr, nullptr, 0, nullptr, 0, nullptr,
+		                                  0 /* stored */, 0) == ZIP_OK);
+		zipWriteInFileInZip(zip, big.data(), big.size());
+		zipCloseFileInZip(zip);
+		zipClose(zip, nullptr);
+	}
+	const std::string bigOutDir = pathToU8(root / "big");
+	BOOST_REQUIRE(fileSystem->extract(brokenZipPath, bigOutDir));
+	BOOST_CHECK(std::filesystem::file_size(root / "big" / "big.txt") == big.size());
+	std::filesystem::remove_all(root / "big");
+	{
+		std::fstream zip(brokenZipPath, std::ios::in | std::ios::out | std::ios::binary);
+		zip.seekp(1000);
+		zip.put('c');
+	}
+	BOOST_CHECK(!fileSystem->extract(brokenZipPath, bigOutDir));
+	BOOST_CHECK(!std::filesystem::exists(root / "big" / "big.txt"));
+
+	// With a store, identical files of different versions are hardlinks.
+	const ContentStore store(pathToU8(root / "store"));
+	const auto versionFile = [&](const std::string& version, int i) {
+		return root / version / ("dir" + std::to_string(i % 5)) / "sub" /
+		       ("file" + std::to_string(i) + ".txt");
+	};
+	for (const std::string version : {"v1", "v2"}) {
+		BOOST_REQUIRE(fileSystem->extract(zipPath, pathToU8(root / version), true, &store));
+	}
+	for (int i = 0; i < numFiles; ++i) {
+		BOOST_CHECK(std::filesystem::equivalent(versionFile("v1", i), versionFile("v2", i)));
+	}
+	// File modified in place isn't linked into other versions.
+	std::ofstream(versionFile("v1", 7)) << "modified";
+	BOOST_REQUIRE(fileSystem->extract(zipPath, pathToU8(root / "v3"), true, &store));
+	BOOST_CHECK(!std::filesystem::equivalent(versionFile("v1", 7), versionFile("v3", 7)));
+	std::ifstream in(versionFile("v3", 7));
+	BOOST_CHECK(std::string(std::istreambuf_iterator<char>(in), {}) == content(7));
+
+	// Files with the same size and CRC32, but different contents, are not mixed up.
+	std::unordered_map<uLong, std::string> crcs;
+	std::string colliding[2];
+	for (int i = 0; colliding[1].empty(); ++i) {
+		char data[16];
+		snprintf(data, sizeof(data), "%012d", i);
+		const auto [it, added] =
+			crcs.emplace(crc32(0L, reinterpret_cast<const Bytef*>(data), 12), data);
+		if (!added) {
+			colliding[0] = it->second;
+			colliding[1] = data;
+		}
+	}
+	for (int i = 0; i < 2; ++i) {
+		const std::string path = pathToU8(root / ("collision" + std::to_string(i) + ".zip"));
+		zipFile zip = zipOpen(path.c_str(), APPEND_STATUS_CREATE);
+		BOOST_REQUIRE(zip != nullptr);
+		BOOST_REQUIRE(zipOpenNewFileInZip(zip, "c.txt", nullptr, nullptr, 0, nullptr, 0, nullptr,
+		                                  Z_DEFLATED, Z_DEFAULT_COMPRESSION) == ZIP_OK);
+		zipWriteInFileInZip(zip, colliding[i].data(), colliding[i].size());
+		zipCloseFileInZip(zip);
+		zipClose(zip, nullptr);
+		const auto dst = root / ("c" + std::to_string(i));
+		BOOST_REQUIRE(fileSystem->extract(path, pathToU8(dst), true, &store));
+		std::ifstream in(dst / "c.txt");
+		BOOST_CHECK(std::string(std::istreambuf_iterator<char>(in), {}) == colliding[i]);
+	}
+
+	std::filesystem::remove_all(root);
+}